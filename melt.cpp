@@ -1,16 +1,530 @@
+#ifndef MELT_BENCH
 #include <curses.h>
+#endif
+#include <algorithm>
+#include <clocale>
+#include <cstdarg>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 #include <string_view>
 #include <vector>
 #include <fstream>
 #include <optional>
 #include <filesystem>
+#include <regex>
 #include <unordered_set>
+#include <unordered_map>
+#include <memory>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MELT_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using vecstr = std::vector<std::string>;
 namespace fsystem = std::filesystem;
 
+#ifdef MELT_BENCH
+//
+// +--------------------+
+// | Headless curses    |
+// +--------------------+
+//
+
+//
+// stub out the curses surface for the benchmark build (make bench), so the
+// full frame pipeline can be driven and timed without a terminal. getch
+// reads from an injected key queue instead of the keyboard
+//
+
+#include <deque>
+
+inline std::deque<int> bench_keys{};
+inline int bench_stdscr = 0;
+#define stdscr (&bench_stdscr)
+
+inline constexpr int ERR = -1;
+inline constexpr int OK = 0;
+inline constexpr int KEY_DOWN = 0402;
+inline constexpr int KEY_UP = 0403;
+inline constexpr int KEY_LEFT = 0404;
+inline constexpr int KEY_RIGHT = 0405;
+inline constexpr int KEY_BACKSPACE = 0407;
+inline constexpr int KEY_ENTER = 0527;
+inline constexpr int COLOR_BLACK = 0;
+inline constexpr int COLOR_BLUE = 4;
+inline constexpr int COLOR_GREEN = 2;
+inline constexpr int COLOR_CYAN = 6;
+inline constexpr int COLOR_MAGENTA = 5;
+inline constexpr int COLOR_YELLOW = 3;
+inline constexpr int COLOR_WHITE = 7;
+
+#define getmaxyx(w, y, x) ((void)(w), (y) = 40, (x) = 120)
+#define COLOR_PAIR(n) (n)
+
+inline void *initscr() { return &bench_stdscr; }
+inline int endwin() { return OK; }
+inline int raw() { return OK; }
+inline int noecho() { return OK; }
+inline int keypad(int *, bool) { return OK; }
+inline int curs_set(int) { return OK; }
+inline int start_color() { return OK; }
+inline int init_pair(int, int, int) { return OK; }
+inline int clear() { return OK; }
+inline int resize_term(int, int) { return OK; }
+inline int refresh() { return OK; }
+inline int move(int, int) { return OK; }
+inline int addch(int) { return OK; }
+inline int addnstr(const char *, int) { return OK; }
+inline int clrtoeol() { return OK; }
+inline int mvdelch(int, int) { return OK; }
+inline int attron(int) { return OK; }
+inline int attroff(int) { return OK; }
+inline int mvaddnstr(int, int, const char *, int) { return OK; }
+inline int mvprintw(int, int, const char *, ...) { return OK; }
+inline int nodelay(int *, bool) { return OK; }
+inline void timeout(int) {}
+
+inline int getch()
+{
+    if (bench_keys.empty())
+        return ERR;
+    int c = bench_keys.front();
+    bench_keys.pop_front();
+    return c;
+}
+
+inline int ungetch(int c)
+{
+    bench_keys.push_front(c);
+    return OK;
+}
+#endif
+
+//
+// +--------------+
+// | Text storage |
+// +--------------+
+//
+
+//
+// bump allocator backed by large slabs - text loaded through the stream
+// path is copied once into a slab and referenced by view, so small files
+// get the same per-line-allocation-free, cache-linear storage as mmap'd
+// ones, and teardown frees a handful of slabs instead of millions of
+// strings. Slab addresses are stable, so views survive Arena moves
+//
+
+class Arena
+{
+  private:
+    std::vector<std::unique_ptr<char[]>> slabs{};
+    size_t used = 0;
+    size_t cap = 0;
+
+    static constexpr size_t SLAB_SIZE = 1 << 20;
+
+  public:
+    char *alloc(size_t n)
+    {
+        if (n > cap - used)
+        {
+            size_t sz = std::max(n, SLAB_SIZE);
+            slabs.push_back(std::make_unique<char[]>(sz));
+            used = 0;
+            cap = sz;
+        }
+        char *p = slabs.back().get() + used;
+        used += n;
+        return p;
+    }
+
+    std::string_view store(const char *s, size_t n)
+    {
+        if (n == 0)
+            return {};
+        char *p = alloc(n);
+        std::memcpy(p, s, n);
+        return {p, n};
+    }
+
+    void clear()
+    {
+        slabs.clear();
+        used = cap = 0;
+    }
+};
+
+//
+// one line of text - either a read-only view into the memory-mapped file or,
+// once the line has been edited, an owned mutable string. Untouched lines of
+// a mapped file never get copied onto the heap. Owned text sits behind a
+// shared_ptr so snapshots share it copy-on-write: mut() clones the string
+// only while a background reader still holds a reference
+//
+
+struct Line
+{
+    std::string_view view{};
+    std::shared_ptr<std::string> owned{};
+    bool is_owned = false;
+
+    // render cache: the tab-expanded form of the line, rebuilt only after an
+    // edit - idle frames and vertical cursor moves do zero expansion work
+    std::string expanded{};
+    bool cache_ok = false;
+
+    // bumped on every mutation, so the frame pipeline can tell whether a
+    // row it already composed is still current
+    unsigned rev = 0;
+
+    // column-translation cache: byte position of each tab and the visual
+    // column just past it, so byte->visual mapping needs no prefix rescans.
+    // Lines without tabs (the common case) keep the identity mapping free
+    std::vector<std::pair<unsigned, unsigned>> tab_cols{};
+    bool tabs_ok = false;
+
+    // highlight cache: one attribute byte per expanded cell, valid for the
+    // recorded lexer entry state - a line is only re-lexed when it was
+    // edited or the state flowing into it changed (block comments)
+    std::string attrs{};
+    unsigned char lex_in = 0;
+    unsigned char lex_out = 0;
+    bool lex_ok = false;
+
+    // lazily computed: does the line contain any non-ASCII byte? Pure
+    // ASCII lines (the common case) keep every byte==cell fast path
+    bool has_mb = false;
+    bool mb_ok = false;
+
+    Line() = default;
+    explicit Line(std::string s) : owned(std::make_shared<std::string>(std::move(s))), is_owned(true) {}
+    explicit Line(std::string_view v) : view(v) {}
+
+    std::string_view text() const { return (is_owned ? std::string_view(*owned) : view); }
+    size_t length() const { return text().length(); }
+
+    bool multibyte()
+    {
+        if (!mb_ok)
+        {
+            has_mb = false;
+            for (unsigned char c : text())
+                if (c & 0x80)
+                {
+                    has_mb = true;
+                    break;
+                }
+            mb_ok = true;
+        }
+        return has_mb;
+    }
+
+    // materialize into an owned string before mutating; a string a live
+    // snapshot still references is cloned first, so readers keep seeing
+    // the frozen text while the editor moves on
+    std::string &mut()
+    {
+        if (!is_owned)
+        {
+            owned = std::make_shared<std::string>(view);
+            is_owned = true;
+        }
+        else if (owned.use_count() > 1)
+            owned = std::make_shared<std::string>(*owned);
+        cache_ok = false;
+        tabs_ok = false;
+        lex_ok = false;
+        mb_ok = false;
+        ++rev;
+        return *owned;
+    }
+};
+
+//
+// an immutable view of one line inside a snapshot - either the original
+// mapped bytes or a reference-counted share of the edited string. Copying
+// one is two pointer copies; no text is duplicated
+//
+
+struct SnapLine
+{
+    std::shared_ptr<const std::string> owned{};
+    std::string_view view{};
+
+    std::string_view text() const { return (owned != nullptr ? std::string_view(*owned) : view); }
+};
+
+// cell attribute bytes, matching the color pairs set up in init (pair =
+// attribute + 1)
+inline constexpr char HL_NONE = 0;
+inline constexpr char HL_COMMENT = 1;
+inline constexpr char HL_STRING = 2;
+inline constexpr char HL_NUMBER = 3;
+inline constexpr char HL_KEYWORD = 4;
+inline constexpr char HL_PREPROC = 5;
+inline constexpr char HL_SELECT = 6;
+
+//
+// gap buffer over whole lines - the gap follows the cursor line, so inserting
+// or removing a line near the last edit is O(1) amortized instead of shifting
+// every line below it like std::vector::insert/erase would
+//
+
+class TextBuffer
+{
+  private:
+    std::vector<Line> buf{};
+    size_t gap_begin = 0;
+    size_t gap_end = 0;
+
+    size_t gapLen() const { return gap_end - gap_begin; }
+
+    // translate a line index to its slot in buf, skipping the gap
+    size_t slot(size_t y) const { return (y < gap_begin ? y : y + gapLen()); }
+
+    void moveGap(size_t y)
+    {
+        while (gap_begin > y)
+        {
+            --gap_begin;
+            --gap_end;
+            buf[gap_end] = std::move(buf[gap_begin]);
+        }
+        while (gap_begin < y)
+        {
+            buf[gap_begin] = std::move(buf[gap_end]);
+            ++gap_begin;
+            ++gap_end;
+        }
+    }
+
+  public:
+    size_t size() const { return buf.size() - gapLen(); }
+    bool empty() const { return size() == 0; }
+
+    Line &operator[](size_t y) { return buf[slot(y)]; }
+    const Line &operator[](size_t y) const { return buf[slot(y)]; }
+
+    void insert(size_t y, Line l)
+    {
+        if (gap_begin == gap_end)
+        {
+            // regrow the gap in one shot so repeated inserts stay amortized O(1)
+            size_t room = std::max<size_t>(64, size() / 8);
+            buf.insert(buf.begin() + gap_begin, room, Line{});
+            gap_end = gap_begin + room;
+        }
+        moveGap(y);
+        buf[gap_begin++] = std::move(l);
+    }
+
+    void erase(size_t y)
+    {
+        moveGap(y);
+        buf[gap_end] = Line{};
+        ++gap_end;
+    }
+
+    void push_back(Line l) { insert(size(), std::move(l)); }
+
+    // take a fully built line vector in one move (bulk load path)
+    void assign(std::vector<Line> &&ls)
+    {
+        buf = std::move(ls);
+        gap_begin = gap_end = buf.size();
+    }
+
+    // frozen copy for background readers - O(lines) pointer copies with no
+    // text duplicated; edits after the snapshot copy-on-write in Line::mut
+    std::vector<SnapLine> snapshot() const
+    {
+        std::vector<SnapLine> out{};
+        out.reserve(size());
+        for (size_t i = 0; i < size(); ++i)
+        {
+            const Line &l = (*this)[i];
+            out.push_back(l.is_owned ? SnapLine{l.owned, {}} : SnapLine{nullptr, l.view});
+        }
+        return out;
+    }
+
+    void clear()
+    {
+        buf.clear();
+        gap_begin = gap_end = 0;
+    }
+};
+
+//
+// +----------+
+// | Undo log |
+// +----------+
+//
+
+//
+// one reversible edit, mirroring the edit primitives; text payloads are
+// slices of a shared arena string, so the journal costs a few bytes per
+// keystroke and applying an undo is O(size of the change), never O(file)
+//
+
+struct UndoRec
+{
+    enum Op
+    {
+        OpInsCh,
+        OpRmCh,
+        OpInsLn,
+        OpRmLn,
+        OpJnLn,
+        OpSpLn,
+        OpInsLns,
+        OpRmLns,
+        OpSetLn
+    };
+
+    Op op;
+    unsigned x = 0;
+    unsigned y = 0;
+    size_t tpos = 0;
+    size_t tlen = 0;
+
+    // nonzero groups adjacent records into one undo/redo step, so a batch
+    // operation (replace-all, macro replay) reverts with a single 'u'
+    unsigned grp = 0;
+};
+
+//
+// +--------------+
+// | Search index |
+// +--------------+
+//
+
+//
+// trigram -> sorted line numbers, built from a snapshot on a worker thread.
+// It only narrows candidates - every hit is verified against the live text,
+// and lines edited since the build are rescanned unconditionally - so a
+// slightly stale index can never produce a wrong match
+//
+
+struct SearchIndex
+{
+    std::unordered_map<uint32_t, std::vector<unsigned>> tri{};
+    unsigned long gen = 0;
+    unsigned long epoch = 0;
+
+    static uint32_t key(std::string_view s, size_t i)
+    {
+        return (static_cast<uint32_t>(static_cast<unsigned char>(s[i])) << 16) |
+               (static_cast<uint32_t>(static_cast<unsigned char>(s[i + 1])) << 8) |
+               static_cast<uint32_t>(static_cast<unsigned char>(s[i + 2]));
+    }
+};
+
+#ifdef MELT_PERF
+//
+// +------------+
+// | Perf rings |
+// +------------+
+//
+
+//
+// fixed-size ring of recent timings (microseconds); percentile queries
+// copy the live entries and nth_element them, which only happens when the
+// HUD is composed, never on the recording path
+//
+
+struct PerfRing
+{
+    static constexpr size_t CAP = 256;
+    uint32_t v[CAP] = {};
+    size_t n = 0;
+
+    void push(uint32_t us) { v[n++ % CAP] = us; }
+
+    uint32_t pct(int p) const
+    {
+        size_t cnt = std::min(n, CAP);
+        if (cnt == 0)
+            return 0;
+        uint32_t tmp[CAP];
+        std::copy(v, v + cnt, tmp);
+        size_t k = (cnt - 1) * p / 100;
+        std::nth_element(tmp, tmp + k, tmp + cnt);
+        return tmp[k];
+    }
+};
+#endif
+
+//
+// +---------+
+// | Buffers |
+// +---------+
+//
+
+//
+// the complete per-file state - text, cursor/scroll position, dirty flag,
+// file mapping, undo journal and search bookkeeping. The active buffer's
+// fields live directly in Melt for hot-path access; a Buffer is the stash
+// a file is parked in while another one is being edited
+//
+
+struct Buffer
+{
+    TextBuffer lines{};
+    Arena arena{};
+    std::string fname{};
+    int fstate = 0;
+    unsigned cx = 0, cy = 0;
+    unsigned ox = 0, oy = 0;
+
+    char *map_base = nullptr;
+    size_t map_len = 0;
+
+    std::vector<UndoRec> undo_log{};
+    std::string undo_arena{};
+    size_t undo_cursor = 0;
+
+    unsigned long edit_gen = 0;
+    unsigned long struct_gen = 0;
+    std::unordered_set<unsigned> search_dirty{};
+    size_t lex_clean = 0;
+
+    // the file used CRLF line endings; stored stripped, restored on save
+    bool crlf = false;
+
+    // background load in flight (guarded by the owner's load_mtx)
+    bool loading = false;
+
+    // LRU tick for eviction of parked clean buffers
+    unsigned long last_used = 0;
+
+    // whether the sidecar journal was already checked for crash recovery
+    bool journal_checked = false;
+
+    Buffer() = default;
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    ~Buffer()
+    {
+#ifdef MELT_HAS_MMAP
+        if (map_base != nullptr)
+            munmap(map_base, map_len);
+#endif
+    }
+};
+
 //
 // +-----------------------+
 // | Core class definition |
@@ -20,14 +534,22 @@ namespace fsystem = std::filesystem;
 class Melt
 {
   private:
-    vecstr lines{};
+    TextBuffer lines{};
+    Arena arena{};
 
     vecstr front{};
     vecstr back{};
 
+    // one attribute byte per cell, diffed alongside the text cells
+    vecstr front_attr{};
+    vecstr back_attr{};
+
     int fstate = 0;
     int edmode = 0;
 
+    // active file used CRLF endings (stored stripped, restored on save)
+    bool crlf = false;
+
     std::string fname{};
     std::string sbar{};
     std::string smessage{};
@@ -43,14 +565,195 @@ class Melt
 
     bool is_running = false;
     bool is_ws_changed = false;
+    bool in_paste = false;
+
+    // everything the presented frame was derived from, stamped after each
+    // render so the main loop can skip frames where nothing visible changed
+    struct FrameStamp
+    {
+        unsigned long edit_gen = 0, struct_gen = 0, buf_epoch = 0;
+        unsigned cx = 0, cy = 0, ox = 0, oy = 0;
+        int fstate = -1;
+        bool sel_on = false;
+        unsigned sel_anchor = 0;
+        std::string smessage{};
+    };
+    FrameStamp last_frame{};
+    bool frame_valid = false;
+
+    // visual line selection (anchor..cursor, inclusive) and the block yank
+    // register - yanked text lives in one contiguous string with lines
+    // separated by '\n', shared across buffers
+    bool sel_on = false;
+    unsigned sel_anchor = 0;
+    std::string yank_buf{};
+    unsigned yank_count = 0;
+
+    // macro state: while recording, every key entering handleKey is
+    // appended; replay feeds them back through handleKey with no frame in
+    // between, so N repetitions cost a single repaint
+    bool macro_rec = false;
+    bool macro_play = false;
+    std::vector<int> macro_keys{};
+
+#ifdef MELT_PERF
+    // perf HUD (make perf, toggled with ESC ?): rings of recent frame and
+    // keystroke timings plus the wall time of the last load and save
+    PerfRing perf_frame{};
+    PerfRing perf_key{};
+    uint32_t perf_load_us = 0;
+    std::atomic<uint32_t> perf_save_us{0};
+    bool hud_on = false;
+#endif
+
+    // which buffer line each back row was composed from (and at which line
+    // revision), so update() only recomputes rows that actually changed
+    std::vector<size_t> row_line{};
+    std::vector<unsigned> row_rev{};
+    unsigned last_row_ox = ~0u;
+    unsigned long last_struct_gen = ~0ul;
+    size_t last_sel_lo = ~static_cast<size_t>(0);
+    size_t last_sel_hi = ~static_cast<size_t>(0);
+
+    // line-number gutter: width in cells (digits plus one space); redrawn
+    // only when the viewport moves or the digit count grows
+    unsigned gut_w = 0;
+    unsigned last_gut_oy = ~0u;
+    size_t last_gut_cnt = 0;
+
+    // syntax highlighting; hl_on is derived from the file extension and
+    // lex_clean counts leading lines whose lexer-state chain is valid
+    bool hl_on = false;
+    size_t lex_clean = 0;
+
+    // backing store of the memory-mapped file, if any
+    char *map_base = nullptr;
+    size_t map_len = 0;
+
+    // background save state; save_result/save_done/save_ok are guarded by
+    // save_mtx, everything else is touched by the UI thread only
+    std::thread save_thread{};
+    std::mutex save_mtx{};
+    std::string save_result{};
+    bool save_done = false;
+    bool save_ok = false;
+    bool save_busy = false;
+    unsigned long save_launch_gen = 0;
+
+    // bumped by every buffer mutation, so "unchanged since" checks are O(1)
+    unsigned long edit_gen = 0;
+
+    // parked buffers; bufs[cur_buf] is the (stale) slot of the active one.
+    // load_thread fills a parked buffer in the background so opening a
+    // second file never blocks the UI
+    std::vector<std::unique_ptr<Buffer>> bufs{};
+    size_t cur_buf = 0;
+    unsigned long lru_tick = 0;
+    unsigned long buf_epoch = 0;
+
+    std::thread load_thread{};
+    std::mutex load_mtx{};
+    Buffer *loading_buf = nullptr;
+    std::string load_result{};
+    bool load_done = false;
+    std::string save_fname{};
+
+    // autosave journal: every mutation is appended (stdio-buffered) to
+    // <fname>.meltj and fsync'd on a timer from a background thread, then
+    // replayed on the next open if the editor died before saving
+    FILE *jnl = nullptr;
+    std::mutex jnl_mtx{};
+    bool jnl_dirty = false;
+    std::thread jnl_thread{};
+    std::atomic<bool> jnl_stop{false};
+    bool journal_mute = false;
+
+    // tail-follow state: a watcher thread reads bytes appended to the file
+    // and hands complete lines over through follow_queue
+    std::thread follow_thread{};
+    std::mutex follow_mtx{};
+    vecstr follow_queue{};
+    std::atomic<bool> follow_stop{false};
+    bool follow_on = false;
+
+    // pager mode (-r): the buffer is read-only and rendered straight from
+    // the mapping; a prefetch thread madvises blocks ahead of the scroll
+    // direction so paging through a cold file doesn't stall on major faults
+    bool pager_on = false;
+    std::thread prefetch_thread{};
+    std::mutex prefetch_mtx{};
+    size_t prefetch_off = 0;
+    size_t prefetch_len = 0;
+    bool prefetch_pending = false;
+    std::atomic<bool> prefetch_stop{false};
+    unsigned prefetch_last_oy = 0;
+
+    // search state; search_index is guarded by index_mtx, struct_gen counts
+    // line insertions/removals (which shift the index's line numbers) and
+    // search_dirty collects lines whose content changed since the build
+    std::thread index_thread{};
+    std::mutex index_mtx{};
+    std::shared_ptr<const SearchIndex> search_index{};
+    bool index_building = false;
+    unsigned long struct_gen = 0;
+    std::unordered_set<unsigned> search_dirty{};
+    std::string last_search{};
+
+    // dirty lines parked when a rebuild is kicked: the new snapshot has
+    // their content, but the index live during the build does not, so
+    // findMatch keeps consulting them until the new index is installed
+    std::vector<unsigned> index_dirty_pending{};
+    const void *index_pending_base = nullptr;
+
+    // undo journal; undo_cursor counts applied records, anything beyond it
+    // is the redo tail. undo_mute suppresses recording while primitives are
+    // invoked internally (jnLn/spLn nesting) or during undo/redo replay
+    std::vector<UndoRec> undo_log{};
+    std::string undo_arena{};
+    size_t undo_cursor = 0;
+    bool undo_mute = false;
+
+    // while undo_grp_open is nonzero, new records join that group and are
+    // undone/redone together (batch replace, macro replay)
+    unsigned undo_grp_next = 1;
+    unsigned undo_grp_open = 0;
 
     // methods
 
     std::optional<std::string> load(std::string_view fn);
-    std::optional<std::string> save(std::string_view fn);
+    static std::optional<std::string> loadInto(Buffer &b, const std::string &fn);
+    static bool restoreSessionInto(Buffer &b, const std::string &fn);
+    static void clampSessionPos(Buffer &b);
+    void saveSession();
+#ifdef MELT_HAS_MMAP
+    static bool loadMappedInto(Buffer &b, const std::string &fn);
+#endif
+    void unmapFile();
+    void saveAsync(std::string fn);
+    void pollSave();
+
+    void stashTo(Buffer &b);
+    void restoreFrom(Buffer &b);
+    void switchTo(size_t i);
+    void openBuffer(const std::string &fn);
+    void pollLoad();
+
+    void startFollow();
+    void stopFollow();
+    void pollFollow();
+
+    void postPrefetch(bool down);
+
+    void jnlWrite(const char *fmt, ...);
+    void jnlClose();
+    void jnlDiscard();
+    void replayJournal();
 
     void processEvents();
+    void handleKey(int ch);
+    bool checkPasteToggle();
     void processCmd(std::string_view c);
+    void replayMacro(unsigned n);
     void mvCursor(int xd, int yd);
     
     void scrollToFit();
@@ -65,21 +768,50 @@ class Melt
     void rmLn(unsigned y);
     void jnLn(unsigned y);
     void spLn(unsigned x, unsigned y);
+    void insLns(unsigned y, std::string_view joined);
+    void rmLns(unsigned y, unsigned n);
+    void setLn(unsigned y, std::string_view s);
+
+    void pushUndo(UndoRec::Op op, unsigned x, unsigned y, std::string_view payload);
+    void undoOne(const UndoRec &r);
+    void redoOne(const UndoRec &r);
+    bool undo();
+    bool redo();
 
+    void replaceRegex(const std::string &pat, const std::string &repl);
+
+    void kickIndexBuild();
+    std::optional<std::pair<unsigned, unsigned>> findMatch(std::string_view term, unsigned fy, unsigned fx);
+    void searchPrompt();
+    std::optional<std::string> linePrompt(std::string_view label);
+
+    bool framePending();
     void update();
     void render();
 
     // helpers
     static void cCheck(int r);
     static bool valFn(std::string_view fn);
+    static std::optional<std::string> writeLines(const std::vector<SnapLine> &snap, const std::string &fn,
+                                                 bool use_crlf = false);
 
-    static std::string escPercent(std::string_view s);
     static std::string expandTabs(std::string_view s);
-    static size_t visualLength(std::string_view s);
+
+    static const std::string &expandedOf(Line &l);
+    static size_t visualColOf(Line &l, size_t x);
+    void fillVisibleLong(Line &l, std::string &row);
+
+    void updateHlMode();
+    void ensureLexed(size_t upto);
+    static void lexLine(Line &l, unsigned char in);
 
   public:
     virtual ~Melt() = default;
 
+#ifdef MELT_BENCH
+    friend int benchMain(int argc, char **argv);
+#endif
+
     void init(int argc, char **argv);
     void shutdown();
 
@@ -89,8 +821,22 @@ class Melt
 
         while (is_running)
         {
-            update();
-            render();
+            // unknown keys, no-op cursor moves at the buffer edge and the
+            // like cost no repaint at all - the loop goes straight back to
+            // blocking in getch, so an idle editor burns no CPU
+            if (framePending())
+            {
+#ifdef MELT_PERF
+                const auto pt0 = std::chrono::steady_clock::now();
+#endif
+                update();
+                render();
+#ifdef MELT_PERF
+                perf_frame.push(static_cast<uint32_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pt0)
+                        .count()));
+#endif
+            }
 
             processEvents();
         }
@@ -105,196 +851,1920 @@ class Melt
 //
 //
 
-int main(int argc, char **argv)
+#ifndef MELT_BENCH
+int main(int argc, char **argv)
+{
+    try
+    {
+        Melt med{};
+
+        med.init(argc, argv);
+        med.run();
+        med.shutdown();
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::printf("Fatal error: %s", (e.what() == nullptr ? "unknown error!" : e.what()));
+        return -1;
+    }
+    catch (...)
+    {
+        std::printf("Failed due to unknown error!");
+        return -1;
+    }
+
+    return 0;
+}
+#endif
+
+//
+//
+// +-----------------------------+
+// | Core methods implementation |
+// +-----------------------------+
+//
+//
+
+//
+// initialization and cleanup handling
+//
+
+// gutter cells needed for a buffer of n lines: digits plus one space
+static unsigned gutterWidthFor(size_t n)
+{
+    unsigned digits = 1;
+    for (; n >= 10; n /= 10)
+        ++digits;
+    return digits + 1;
+}
+
+void Melt::init(int argc, char **argv)
+{
+    // file operations
+    lines.push_back({});
+    bufs.push_back(std::make_unique<Buffer>());
+
+    auto fback = [this](std::string msg = "") -> void {
+        fname.clear();
+        fstate = 0;
+        smessage = std::move(msg);
+    };
+
+    // -r opens the file as a read-only pager
+    int argi = 1;
+    if (argc > 1 && std::string_view{argv[1]} == "-r")
+    {
+        pager_on = true;
+        ++argi;
+    }
+
+    if (argc > argi)
+    {
+        fname = argv[argi];
+        fstate = 1;
+        if (fname.empty())
+            fback();
+        else if (!valFn(fname))
+            fback("Invalid filename!");
+        else if (fsystem::path p = fname; !fsystem::exists(fname))
+            fstate = 0;
+        else if (auto r = load(fname); r.has_value())
+            fback(r.value());
+        else
+        {
+            // a pager never mutates, so leftover journals stay untouched
+            if (!pager_on)
+                replayJournal();
+            kickIndexBuild();
+        }
+    }
+    else
+        fback();
+    bufs[0]->journal_checked = true;
+    updateHlMode();
+
+    // flush and fsync the autosave journal on a timer so the hot path only
+    // ever pays for a buffered fprintf
+    jnl_thread = std::thread([this]() {
+        while (!jnl_stop)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+            std::lock_guard<std::mutex> lk{jnl_mtx};
+            if (jnl != nullptr && jnl_dirty)
+            {
+                std::fflush(jnl);
+#ifdef MELT_HAS_MMAP
+                fsync(fileno(jnl));
+#endif
+                jnl_dirty = false;
+            }
+        }
+    });
+
+#ifdef MELT_HAS_MMAP
+    // pager prefetch: poll for posted ranges and madvise them, so readahead
+    // of a cold file happens off the frame path. The mapping outlives the
+    // thread (joined in shutdown), and madvise is only ever a hint
+    if (pager_on && map_base != nullptr)
+    {
+        prefetch_thread = std::thread([this, base = map_base, mlen = map_len]() {
+            while (!prefetch_stop)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+                size_t off = 0, len = 0;
+                {
+                    std::lock_guard<std::mutex> lk{prefetch_mtx};
+                    if (!prefetch_pending)
+                        continue;
+                    off = prefetch_off;
+                    len = prefetch_len;
+                    prefetch_pending = false;
+                }
+
+                size_t from = off & ~static_cast<size_t>(4095);
+                size_t to = std::min(off + len, mlen);
+                if (to > from)
+                    madvise(base + from, to - from, MADV_WILLNEED);
+            }
+        });
+    }
+#endif
+
+    // initialize curses; the locale makes ncursesw interpret byte strings
+    // as the user's encoding (UTF-8 wanted), so the cursor advances by
+    // display width instead of byte count on multibyte text
+    std::setlocale(LC_ALL, "");
+    if (initscr() == nullptr)
+        throw std::runtime_error{"Curses initialization failed!"};
+
+    // disable line-buffering and special key detection
+    cCheck(raw());
+    cCheck(keypad(stdscr, true));
+    cCheck(noecho());
+
+    curs_set(1);
+
+#ifndef MELT_BENCH
+    // ask the terminal to bracket pastes so we can batch them
+    std::printf("\033[?2004h");
+    std::fflush(stdout);
+#endif
+
+    start_color();
+    init_pair(1, COLOR_BLACK, COLOR_WHITE);
+
+    // syntax attribute colors, indexed as pair = attribute + 1
+    init_pair(2, COLOR_CYAN, COLOR_BLACK);    // comment
+    init_pair(3, COLOR_YELLOW, COLOR_BLACK);  // string/char literal
+    init_pair(4, COLOR_MAGENTA, COLOR_BLACK); // number
+    init_pair(5, COLOR_GREEN, COLOR_BLACK);   // keyword
+    init_pair(6, COLOR_BLUE, COLOR_BLACK);    // preprocessor
+    init_pair(7, COLOR_BLACK, COLOR_WHITE);   // line selection
+
+    getmaxyx(stdscr, my, mx);
+    gut_w = gutterWidthFor(lines.size());
+    ax = mx - gut_w;
+    ay = my - 2;
+
+    if (ax < 40 || ay < 12)
+        throw std::runtime_error{"Terminal size too small!"};
+
+    back.resize(ay, std::string(ax, ' '));
+    front.resize(ay, std::string(ax, ' '));
+    back_attr.resize(ay, std::string(ax, '\0'));
+    front_attr.resize(ay, std::string(ax, '\0'));
+
+    // force initial redraw
+    is_ws_changed = true;
+
+    // a session-restored position may not fit the fresh window geometry
+    scrollToFit();
+}
+
+void Melt::shutdown()
+{
+    stopFollow();
+    jnl_stop = true;
+    if (jnl_thread.joinable())
+        jnl_thread.join();
+
+    // quitting is an explicit decision about unsaved changes, so leftover
+    // journals would only resurrect edits the user chose to drop
+    jnlDiscard();
+    for (size_t i = 0; i < bufs.size(); ++i)
+    {
+        if (i != cur_buf && !bufs[i]->fname.empty())
+        {
+            std::error_code ec{};
+            fsystem::remove(bufs[i]->fname + ".meltj", ec);
+        }
+    }
+
+    prefetch_stop = true;
+    if (prefetch_thread.joinable())
+        prefetch_thread.join();
+
+    if (save_thread.joinable())
+        save_thread.join();
+    if (index_thread.joinable())
+        index_thread.join();
+    if (load_thread.joinable())
+        load_thread.join();
+
+#ifndef MELT_BENCH
+    std::printf("\033[?2004l");
+    std::fflush(stdout);
+#endif
+    endwin();
+    unmapFile();
+}
+
+//
+// file I/O
+//
+
+inline constexpr size_t MMAP_MIN_SIZE = 1 << 20;
+
+//
+// session sidecar (<fname>.melts) - the cursor/scroll position and, for
+// mapped files, the line-start offsets, keyed by file size and mtime so a
+// cache from an older version of the file can never be applied
+//
+
+struct SessionHdr
+{
+    char magic[8];
+    uint64_t fsize;
+    int64_t mtime;
+    uint32_t cx, cy, ox, oy;
+    uint8_t crlf;
+    uint8_t has_index;
+    uint8_t pad[6];
+    uint64_t nlines;
+};
+
+inline constexpr char SESSION_MAGIC[8] = {'M', 'E', 'L', 'T', 'S', '0', '1', 0};
+
+static bool sessionKey(const std::string &fn, uint64_t &fsize, int64_t &mtime)
+{
+    std::error_code ec{};
+    auto sz = fsystem::file_size(fn, ec);
+    if (ec)
+        return false;
+    auto mt = fsystem::last_write_time(fn, ec);
+    if (ec)
+        return false;
+    fsize = sz;
+    mtime = static_cast<int64_t>(mt.time_since_epoch().count());
+    return true;
+}
+
+#ifdef MELT_HAS_MMAP
+//
+// map large files instead of reading them - lines start out as views into
+// the mapping and are only copied onto the heap once edited (see Line::mut),
+// so opening a huge file allocates next to nothing
+//
+
+bool Melt::loadMappedInto(Buffer &b, const std::string &fn)
+{
+    int fd = ::open(fn.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st
+    {
+    };
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || static_cast<size_t>(st.st_size) < MMAP_MIN_SIZE)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    b.map_base = static_cast<char *>(p);
+    b.map_len = st.st_size;
+
+    b.lines.clear();
+    const char *base = b.map_base;
+    const size_t len = b.map_len;
+
+    // CRLF files are stored with the '\r' stripped off the views (the raw
+    // bytes stay in the mapping) and get it back on save
+    const char *first_nl = static_cast<const char *>(memchr(base, '\n', len));
+    b.crlf = (first_nl != nullptr && first_nl > base && first_nl[-1] == '\r');
+
+    // an unchanged file reopened with a matching session sidecar skips the
+    // newline scan entirely - the views come straight from the cached index
+    if (restoreSessionInto(b, fn))
+    {
+        if (b.lines.empty())
+            b.lines.push_back({});
+        clampSessionPos(b);
+        return true;
+    }
+
+    // scan a half-open byte range whose start is a line start, collecting
+    // views; memchr is the portable way to get the libc's vectorized scanner
+    auto scanRange = [base](size_t from, size_t to, std::vector<Line> &out) {
+        const char *s = base + from;
+        const char *end = base + to;
+        while (s < end)
+        {
+            const char *nl = static_cast<const char *>(memchr(s, '\n', end - s));
+            if (nl == nullptr)
+                nl = end;
+            size_t n = nl - s;
+            if (n > 0 && s[n - 1] == '\r')
+                --n;
+            out.push_back(Line{std::string_view(s, n)});
+            s = nl + 1;
+        }
+    };
+
+    // split the mapping across the available cores, snapping every chunk
+    // boundary forward to the next line start so no line straddles two
+    // workers, then stitch the per-chunk results back together in order
+    size_t nthreads = std::thread::hardware_concurrency();
+    if (nthreads == 0)
+        nthreads = 1;
+    if (len < (8u << 20))
+        nthreads = 1;
+
+    std::vector<size_t> starts(nthreads + 1, len);
+    starts[0] = 0;
+    for (size_t i = 1; i < nthreads; ++i)
+    {
+        size_t pos = len * i / nthreads;
+        const char *nl = static_cast<const char *>(memchr(base + pos, '\n', len - pos));
+        starts[i] = (nl != nullptr ? static_cast<size_t>(nl - base) + 1 : len);
+    }
+
+    std::vector<std::vector<Line>> parts(nthreads);
+    std::vector<std::thread> workers{};
+    for (size_t i = 1; i < nthreads; ++i)
+        workers.emplace_back([&, i]() { scanRange(starts[i], starts[i + 1], parts[i]); });
+    scanRange(starts[0], starts[1], parts[0]);
+    for (auto &w : workers)
+        w.join();
+
+    size_t total = 0;
+    for (const auto &p : parts)
+        total += p.size();
+
+    std::vector<Line> all{};
+    all.reserve(total);
+    for (auto &p : parts)
+        all.insert(all.end(), std::make_move_iterator(p.begin()), std::make_move_iterator(p.end()));
+    b.lines.assign(std::move(all));
+
+    if (b.lines.empty())
+        b.lines.push_back({});
+    clampSessionPos(b);
+    return true;
+}
+#endif
+
+void Melt::unmapFile()
+{
+#ifdef MELT_HAS_MMAP
+    if (map_base != nullptr)
+        munmap(map_base, map_len);
+#endif
+    map_base = nullptr;
+    map_len = 0;
+}
+
+//
+// fill a buffer from a file; runs on the UI thread for the initial file and
+// on a worker thread for buffers opened while editing
+//
+
+std::optional<std::string> Melt::loadInto(Buffer &b, const std::string &fn)
+{
+    if (fn.empty())
+        return {"Empty filename!"};
+
+#ifdef MELT_HAS_MMAP
+    if (loadMappedInto(b, fn))
+        return std::nullopt;
+#endif
+
+    std::ifstream f;
+
+    f.open(fn);
+    if (!f.is_open())
+        return {"Failed to open " + fn + " for reading!"};
+    b.lines.clear();
+
+    // read in large chunks and split on memchr instead of byte-at-a-time
+    // getline; a line cut off at a chunk boundary is carried over
+    std::string chunk(1 << 20, '\0');
+    std::string carry{};
+    while (f)
+    {
+        f.read(chunk.data(), chunk.size());
+        size_t got = f.gcount();
+        if (got == 0)
+            break;
+
+        const char *p = chunk.data();
+        const char *end = p + got;
+        while (p < end)
+        {
+            const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+            if (nl == nullptr)
+            {
+                carry.append(p, end - p);
+                break;
+            }
+            if (!b.crlf && nl > p && nl[-1] == '\r' && b.lines.empty() && carry.empty())
+                b.crlf = true;
+            if (!carry.empty())
+            {
+                carry.append(p, nl - p);
+                if (!carry.empty() && carry.back() == '\r')
+                    carry.pop_back();
+                b.lines.push_back(Line{b.arena.store(carry.data(), carry.length())});
+                carry.clear();
+            }
+            else
+            {
+                size_t n = nl - p;
+                if (n > 0 && nl[-1] == '\r')
+                    --n;
+                b.lines.push_back(Line{b.arena.store(p, n)});
+            }
+            p = nl + 1;
+        }
+    }
+    if (f.bad())
+    {
+        b.lines.clear();
+        b.lines.push_back({});
+        return {"Failed to read from " + fn + " due to unknown error!"};
+    }
+    if (!carry.empty())
+        b.lines.push_back(Line{b.arena.store(carry.data(), carry.length())});
+
+    f.close();
+
+    if (b.lines.empty())
+        b.lines.push_back({});
+
+    // streamed files carry no index, but the position still comes back
+    restoreSessionInto(b, fn);
+    clampSessionPos(b);
+    return std::nullopt;
+}
+
+std::optional<std::string> Melt::load(std::string_view fn)
+{
+    Buffer tmp{};
+#ifdef MELT_PERF
+    const auto pt0 = std::chrono::steady_clock::now();
+#endif
+    if (auto r = loadInto(tmp, std::string(fn)); r.has_value())
+        return r;
+#ifdef MELT_PERF
+    perf_load_us = static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pt0).count());
+#endif
+
+    unmapFile();
+    lines = std::move(tmp.lines);
+    arena = std::move(tmp.arena);
+    map_base = tmp.map_base;
+    map_len = tmp.map_len;
+    tmp.map_base = nullptr;
+    lex_clean = 0;
+    crlf = tmp.crlf;
+    cx = tmp.cx;
+    cy = tmp.cy;
+    ox = tmp.ox;
+    oy = tmp.oy;
+
+    return std::nullopt;
+}
+
+//
+// apply a matching session sidecar: the position always, and for a mapped
+// buffer the line index too, rebuilding the views from the cached starts
+// without scanning a single byte of the file. Returns whether the index
+// was applied (so the caller knows to skip its own scan)
+//
+
+bool Melt::restoreSessionInto(Buffer &b, const std::string &fn)
+{
+    std::ifstream f{fn + ".melts", std::ios::binary};
+    if (!f.is_open())
+        return false;
+
+    SessionHdr h{};
+    f.read(reinterpret_cast<char *>(&h), sizeof(h));
+
+    uint64_t fsize = 0;
+    int64_t mtime = 0;
+    if (!f || std::memcmp(h.magic, SESSION_MAGIC, sizeof(h.magic)) != 0 || !sessionKey(fn, fsize, mtime) ||
+        h.fsize != fsize || h.mtime != mtime)
+    {
+        // stale sidecars are dead weight - the key will never match again
+        f.close();
+        std::error_code ec{};
+        fsystem::remove(fn + ".melts", ec);
+        return false;
+    }
+
+    b.cx = h.cx;
+    b.cy = h.cy;
+    b.ox = h.ox;
+    b.oy = h.oy;
+
+    if (h.has_index == 0 || h.nlines == 0 || b.map_base == nullptr || (h.crlf != 0) != b.crlf)
+        return false;
+
+    std::vector<uint64_t> offs(h.nlines);
+    f.read(reinterpret_cast<char *>(offs.data()), h.nlines * sizeof(uint64_t));
+    if (!f || offs[0] != 0 || offs.back() >= b.map_len)
+        return false;
+
+    // line length comes from the next start, so only CRLF files (which need
+    // the trailing '\r' stripped) ever touch the mapped bytes here
+    const char *base = b.map_base;
+    std::vector<Line> all{};
+    all.reserve(h.nlines);
+    for (size_t i = 0; i < h.nlines; ++i)
+    {
+        const size_t s = offs[i];
+        size_t n;
+        if (i + 1 < h.nlines)
+        {
+            if (offs[i + 1] <= s)
+                return false;
+            n = offs[i + 1] - s - 1;
+        }
+        else
+        {
+            n = b.map_len - s;
+            if (n > 0 && base[s + n - 1] == '\n')
+                --n;
+        }
+        if (b.crlf && n > 0 && base[s + n - 1] == '\r')
+            --n;
+        all.push_back(Line{std::string_view(base + s, n)});
+    }
+    b.lines.assign(std::move(all));
+    return true;
+}
+
+//
+// a position-only sidecar can outlive edits that were never saved (the
+// file on disk still matches), so a restored cursor is clamped to the
+// lines actually loaded
+//
+
+void Melt::clampSessionPos(Buffer &b)
+{
+    if (b.lines.empty())
+        return;
+    b.cy = std::min(b.cy, static_cast<unsigned>(b.lines.size() - 1));
+    b.cx = std::min(b.cx, static_cast<unsigned>(b.lines[b.cy].length()));
+    b.oy = std::min(b.oy, b.cy);
+    if (b.cx == 0)
+        b.ox = 0;
+}
+
+//
+// written on quit. The offset index must describe the file byte for byte:
+// every line an unedited view, tiling the mapping end to end. A buffer
+// that was never edited is scan output and tiles by construction; after
+// edits the tiling is verified, since deleted lines leave gaps that the
+// next-start length reconstruction would silently paper over
+//
+
+void Melt::saveSession()
+{
+    if (fname.empty())
+        return;
+
+    uint64_t fsize = 0;
+    int64_t mtime = 0;
+    if (!sessionKey(fname, fsize, mtime))
+        return;
+
+    bool index_ok = (map_base != nullptr && !lines.empty());
+    const bool verify = (edit_gen != 0);
+    const char *expect = map_base;
+    const char *end = map_base + map_len;
+    for (size_t i = 0; index_ok && i < lines.size(); ++i)
+    {
+        const Line &l = lines[i];
+        if (l.is_owned)
+        {
+            index_ok = false;
+            break;
+        }
+        if (!verify)
+            continue;
+        if (l.view.data() != expect)
+        {
+            index_ok = false;
+            break;
+        }
+        const char *e = l.view.data() + l.view.length();
+        if (e < end && *e == '\r')
+            ++e;
+        if (e < end)
+        {
+            if (*e != '\n')
+            {
+                index_ok = false;
+                break;
+            }
+            ++e;
+        }
+        expect = e;
+    }
+    if (verify && expect != end)
+        index_ok = false;
+
+    SessionHdr h{};
+    std::memcpy(h.magic, SESSION_MAGIC, sizeof(h.magic));
+    h.fsize = fsize;
+    h.mtime = mtime;
+    h.cx = cx;
+    h.cy = cy;
+    h.ox = ox;
+    h.oy = oy;
+    h.crlf = crlf ? 1 : 0;
+    h.has_index = index_ok ? 1 : 0;
+    h.nlines = index_ok ? lines.size() : 0;
+
+    std::ofstream f{fname + ".melts", std::ios::binary | std::ios::trunc};
+    if (!f.is_open())
+        return;
+    f.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    if (index_ok)
+        for (size_t i = 0; i < lines.size(); ++i)
+        {
+            const uint64_t off = static_cast<uint64_t>(lines[i].view.data() - map_base);
+            f.write(reinterpret_cast<const char *>(&off), sizeof(off));
+        }
+}
+
+//
+// write a snapshot to a temp file next to the target and atomically rename
+// it into place, so a crash mid-save never truncates the original
+//
+
+std::optional<std::string> Melt::writeLines(const std::vector<SnapLine> &snap, const std::string &fn,
+                                            const bool use_crlf)
+{
+    std::string tmp = fn + ".melt~";
+
+    std::ofstream f;
+    f.open(tmp);
+    if (!f.is_open())
+        return {"Failed to open " + tmp + " for writing!"};
+
+    const char *eol = use_crlf ? "\r\n" : "\n";
+    for (const auto &l : snap)
+        f << l.text() << eol;
+
+    f.flush();
+    if (!f.good())
+        return {"Failed to write to " + tmp + "!"};
+    f.close();
+
+    std::error_code ec{};
+    fsystem::rename(tmp, fn, ec);
+    if (ec)
+        return {"Failed to replace " + fn + "!"};
+
+    return std::nullopt;
+}
+
+//
+// save on a background thread: snapshot the buffer (cheap - see
+// TextBuffer::snapshot), hand it to a writer thread and poll for the result
+// each frame, so the UI never blocks on disk
+//
+
+void Melt::saveAsync(std::string fn)
+{
+    if (fn.empty())
+    {
+        smessage = "Empty filename!";
+        return;
+    }
+    if (save_busy)
+    {
+        smessage = "Save already in progress!";
+        return;
+    }
+    if (save_thread.joinable())
+        save_thread.join();
+
+    save_busy = true;
+    save_launch_gen = edit_gen;
+    save_fname = fn;
+    smessage = "Saving " + fn + "...";
+
+    save_thread = std::thread([this, fn = std::move(fn), snap = lines.snapshot(), use_crlf = crlf]() {
+#ifdef MELT_PERF
+        const auto pt0 = std::chrono::steady_clock::now();
+#endif
+        auto err = writeLines(snap, fn, use_crlf);
+#ifdef MELT_PERF
+        perf_save_us = static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pt0).count());
+#endif
+
+        std::lock_guard<std::mutex> lk{save_mtx};
+        save_ok = !err.has_value();
+        save_result = (save_ok ? "Successfully written to " + fn : err.value());
+        save_done = true;
+    });
+}
+
+void Melt::pollSave()
+{
+    if (!save_busy)
+        return;
+
+    bool done = false;
+    {
+        std::lock_guard<std::mutex> lk{save_mtx};
+        if (save_done)
+        {
+            done = true;
+            save_done = false;
+            smessage = save_result;
+            // only mark clean if nothing was typed while the writer ran
+            if (save_ok && edit_gen == save_launch_gen && fname == save_fname)
+            {
+                fstate = 1;
+                jnlDiscard();
+            }
+        }
+    }
+    if (done)
+    {
+        save_thread.join();
+        save_busy = false;
+    }
+}
+
+//
+// buffer switching - the active buffer's state is swapped in and out of
+// Melt's own fields, so nothing on the edit/render hot paths pays for
+// the indirection of going through a Buffer pointer
+//
+
+void Melt::stashTo(Buffer &b)
+{
+    b.lines = std::move(lines);
+    b.arena = std::move(arena);
+    b.fname = std::move(fname);
+    b.fstate = fstate;
+    b.cx = cx;
+    b.cy = cy;
+    b.ox = ox;
+    b.oy = oy;
+    b.map_base = map_base;
+    b.map_len = map_len;
+    map_base = nullptr;
+    map_len = 0;
+    b.undo_log = std::move(undo_log);
+    b.undo_arena = std::move(undo_arena);
+    b.undo_cursor = undo_cursor;
+    b.edit_gen = edit_gen;
+    b.struct_gen = struct_gen;
+    b.search_dirty = std::move(search_dirty);
+    b.lex_clean = lex_clean;
+    b.crlf = crlf;
+    b.last_used = ++lru_tick;
+}
+
+void Melt::restoreFrom(Buffer &b)
+{
+    lines = std::move(b.lines);
+    arena = std::move(b.arena);
+    fname = std::move(b.fname);
+    fstate = b.fstate;
+    cx = b.cx;
+    cy = b.cy;
+    ox = b.ox;
+    oy = b.oy;
+    map_base = b.map_base;
+    map_len = b.map_len;
+    b.map_base = nullptr;
+    b.map_len = 0;
+    undo_log = std::move(b.undo_log);
+    undo_arena = std::move(b.undo_arena);
+    undo_cursor = b.undo_cursor;
+    edit_gen = b.edit_gen;
+    struct_gen = b.struct_gen;
+    search_dirty = std::move(b.search_dirty);
+    lex_clean = b.lex_clean;
+    crlf = b.crlf;
+    b.last_used = ++lru_tick;
+}
+
+void Melt::switchTo(size_t i)
+{
+    if (i >= bufs.size() || i == cur_buf)
+        return;
+
+    // a buffer still loading in the background must finish first; by the
+    // time the user switches this is almost always already done
+    {
+        std::lock_guard<std::mutex> lk{load_mtx};
+        if (bufs[i]->loading && !load_done)
+            smessage = "Still loading " + bufs[i]->fname + "...";
+    }
+    pollLoad();
+    {
+        std::lock_guard<std::mutex> lk{load_mtx};
+        if (bufs[i]->loading)
+            return;
+    }
+
+    // the watcher and the journal handle belong to the file we're leaving
+    stopFollow();
+    jnlClose();
+
+    stashTo(*bufs[cur_buf]);
+    cur_buf = i;
+    restoreFrom(*bufs[cur_buf]);
+
+    if (!bufs[cur_buf]->journal_checked)
+    {
+        bufs[cur_buf]->journal_checked = true;
+        replayJournal();
+    }
+
+    // the search index and the composed rows belong to the old buffer
+    ++buf_epoch;
+    {
+        std::lock_guard<std::mutex> lk{index_mtx};
+        search_index.reset();
+    }
+    // selection ranges are line numbers in the buffer we just left
+    sel_on = false;
+
+    is_ws_changed = true;
+    updateHlMode();
+    scrollToFit();
+}
+
+inline constexpr size_t MAX_BUFFERS = 8;
+
+void Melt::openBuffer(const std::string &fn)
+{
+    {
+        std::lock_guard<std::mutex> lk{load_mtx};
+        if (loading_buf != nullptr && !load_done)
+        {
+            smessage = "Another file is still loading!";
+            return;
+        }
+    }
+    pollLoad();
+
+    // reuse an already open buffer for the same file
+    for (size_t i = 0; i < bufs.size(); ++i)
+    {
+        if (i != cur_buf && bufs[i]->fname == fn)
+        {
+            switchTo(i);
+            return;
+        }
+    }
+
+    // evict the least recently used parked clean buffer if we're at the cap
+    if (bufs.size() >= MAX_BUFFERS)
+    {
+        // an in-flight index build may still be reading a parked buffer's
+        // snapshot through raw views into its mapping and arena; let it
+        // finish before a victim frees them
+        if (index_thread.joinable())
+            index_thread.join();
+
+        size_t victim = bufs.size();
+        for (size_t i = 0; i < bufs.size(); ++i)
+        {
+            if (i == cur_buf || bufs[i]->fstate == 2 || bufs[i]->loading)
+                continue;
+            // the background writer may still be reading this buffer's slabs
+            if (save_busy && bufs[i]->fname == save_fname)
+                continue;
+            if (victim == bufs.size() || bufs[i]->last_used < bufs[victim]->last_used)
+                victim = i;
+        }
+        if (victim == bufs.size())
+        {
+            smessage = "Too many modified buffers open!";
+            return;
+        }
+        bufs.erase(bufs.begin() + victim);
+        if (victim < cur_buf)
+            --cur_buf;
+    }
+
+    auto nb = std::make_unique<Buffer>();
+    nb->fname = fn;
+    nb->fstate = fsystem::exists(fn) ? 1 : 0;
+    nb->loading = nb->fstate == 1;
+    nb->lines.push_back({});
+    Buffer *target = nb.get();
+    bufs.push_back(std::move(nb));
+
+    if (!target->loading)
+    {
+        switchTo(bufs.size() - 1);
+        return;
+    }
+
+    if (load_thread.joinable())
+        load_thread.join();
+    loading_buf = target;
+    smessage = "Loading " + fn + "...";
+
+    load_thread = std::thread([this, target, fn]() {
+        auto err = loadInto(*target, fn);
+
+        std::lock_guard<std::mutex> lk{load_mtx};
+        load_result = (err.has_value() ? err.value() : "Opened " + fn);
+        load_done = true;
+    });
+}
+
+void Melt::pollLoad()
+{
+    bool done = false;
+    {
+        std::lock_guard<std::mutex> lk{load_mtx};
+        if (load_done)
+        {
+            done = true;
+            load_done = false;
+            loading_buf->loading = false;
+            loading_buf = nullptr;
+            smessage = load_result;
+        }
+    }
+    if (done)
+        load_thread.join();
+}
+
+//
+// autosave journal - each record is one line mirroring an edit primitive:
+// "I x y c", "R x y", "L y text", "D y", "J y", "S x y". Appending costs a
+// buffered fprintf; a timer thread flushes and fsyncs so at most ~2s of
+// typing can be lost to a crash, and a leftover journal is replayed the
+// next time the same file is opened
+//
+
+void Melt::jnlWrite(const char *fmt, ...)
+{
+    if (journal_mute || fname.empty())
+        return;
+
+    std::lock_guard<std::mutex> lk{jnl_mtx};
+    if (jnl == nullptr)
+    {
+        jnl = std::fopen((fname + ".meltj").c_str(), "a");
+        if (jnl == nullptr)
+            return;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    std::vfprintf(jnl, fmt, ap);
+    va_end(ap);
+    jnl_dirty = true;
+}
+
+void Melt::jnlClose()
+{
+    std::lock_guard<std::mutex> lk{jnl_mtx};
+    if (jnl != nullptr)
+    {
+        std::fclose(jnl);
+        jnl = nullptr;
+        jnl_dirty = false;
+    }
+}
+
+//
+// a successful save (or an explicit quit) makes the journal obsolete
+//
+
+void Melt::jnlDiscard()
+{
+    jnlClose();
+    if (!fname.empty())
+    {
+        std::error_code ec{};
+        fsystem::remove(fname + ".meltj", ec);
+    }
+}
+
+void Melt::replayJournal()
+{
+    if (fname.empty())
+        return;
+
+    std::ifstream f{fname + ".meltj"};
+    if (!f.is_open())
+        return;
+
+    journal_mute = true;
+    size_t n = 0;
+    std::string s{};
+    while (std::getline(f, s))
+    {
+        if (s.length() < 3)
+            continue;
+
+        char *q = nullptr;
+        const char *p = s.c_str() + 2;
+        unsigned a = static_cast<unsigned>(std::strtoul(p, &q, 10));
+
+        // L carries verbatim text: opcode, y, one literal space, rest of
+        // line. The two-number parse below must not see it - strtoul would
+        // eat leading digits and (skipping whitespace) indentation
+        if (s[0] == 'L')
+        {
+            size_t at = static_cast<size_t>(q - s.c_str());
+            if (at < s.length() && s[at] == ' ')
+                ++at;
+            insLn(a, s.substr(at));
+            ++n;
+            continue;
+        }
+
+        unsigned b = (q != nullptr && *q == ' ' ? static_cast<unsigned>(std::strtoul(q + 1, &q, 10)) : 0);
+
+        switch (s[0])
+        {
+        case 'I':
+            if (q != nullptr && static_cast<size_t>(q - s.c_str()) + 1 < s.length())
+                insCh(a, b, s[q - s.c_str() + 1]);
+            break;
+        case 'R':
+            rmCh(a, b);
+            break;
+        case 'D':
+            rmLn(a);
+            break;
+        case 'J':
+            jnLn(a);
+            break;
+        case 'S':
+            spLn(a, b);
+            break;
+        default:
+            break;
+        }
+        ++n;
+    }
+    journal_mute = false;
+
+    if (n > 0)
+    {
+        fstate = 2;
+        smessage = "Recovered " + std::to_string(n) + " unsaved change(s) from journal";
+    }
+}
+
+//
+// tail-follow mode - a watcher thread polls the file for growth and reads
+// only the appended bytes; complete lines are handed to the UI thread via
+// follow_queue and drained once per frame in pollFollow
+//
+
+void Melt::startFollow()
+{
+    std::error_code ec{};
+    uintmax_t off = fsystem::file_size(fname, ec);
+    if (ec)
+        off = 0;
+
+    follow_stop = false;
+    follow_on = true;
+
+    follow_thread = std::thread([this, fn = fname, off]() mutable {
+        while (!follow_stop)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+            std::error_code e{};
+            uintmax_t sz = fsystem::file_size(fn, e);
+            if (e || sz <= off)
+                continue;
+
+            std::ifstream f{fn, std::ios::binary};
+            if (!f.is_open())
+                continue;
+            f.seekg(off);
+
+            std::string chunk(sz - off, '\0');
+            f.read(chunk.data(), chunk.size());
+            chunk.resize(f.gcount());
+
+            // hand over complete lines only; a trailing partial line stays
+            // on disk and is picked up once its newline arrives
+            size_t last_nl = chunk.rfind('\n');
+            if (last_nl == std::string::npos)
+                continue;
+            off += last_nl + 1;
+
+            vecstr batch{};
+            size_t p = 0;
+            while (p <= last_nl)
+            {
+                size_t nl = chunk.find('\n', p);
+                batch.push_back(chunk.substr(p, nl - p));
+                p = nl + 1;
+            }
+
+            std::lock_guard<std::mutex> lk{follow_mtx};
+            follow_queue.insert(follow_queue.end(), std::make_move_iterator(batch.begin()),
+                                std::make_move_iterator(batch.end()));
+        }
+    });
+}
+
+void Melt::stopFollow()
+{
+    if (!follow_on)
+        return;
+
+    follow_stop = true;
+    if (follow_thread.joinable())
+        follow_thread.join();
+    follow_on = false;
+
+    std::lock_guard<std::mutex> lk{follow_mtx};
+    follow_queue.clear();
+}
+
+void Melt::pollFollow()
+{
+    if (!follow_on)
+        return;
+
+    vecstr q{};
+    {
+        std::lock_guard<std::mutex> lk{follow_mtx};
+        q.swap(follow_queue);
+    }
+    if (q.empty())
+        return;
+
+    // stick to the bottom if the cursor was already there, like tail -f
+    bool at_bottom = (cy + 1 >= lines.size());
+
+    for (auto &s : q)
+        lines.push_back(Line{std::move(s)});
+    ++struct_gen;
+
+    if (at_bottom)
+    {
+        cy = lines.size() - 1;
+        cx = 0;
+        scrollToFit();
+    }
+}
+
+//
+// pager prefetch - post the byte range of the next block of lines in the
+// scroll direction for the madvise thread to pick up
+//
+
+inline constexpr size_t PREFETCH_LINES = 4096;
+
+void Melt::postPrefetch(const bool down)
+{
+#ifdef MELT_HAS_MMAP
+    if (map_base == nullptr)
+        return;
+
+    size_t from = down ? std::min<size_t>(oy + ay, lines.size())
+                       : (oy > PREFETCH_LINES ? oy - PREFETCH_LINES : 0);
+    size_t to = down ? std::min<size_t>(oy + ay + PREFETCH_LINES, lines.size()) : oy;
+
+    // bound the range by the first and last still-mapped views in it
+    const char *lo = nullptr;
+    const char *hi = nullptr;
+    for (size_t i = from; i < to; ++i)
+    {
+        const Line &l = lines[i];
+        if (l.is_owned || l.view.data() == nullptr)
+            continue;
+        if (l.view.data() < map_base || l.view.data() >= map_base + map_len)
+            continue;
+        if (lo == nullptr)
+            lo = l.view.data();
+        hi = l.view.data() + l.view.length();
+    }
+    if (lo == nullptr || hi <= lo)
+        return;
+
+    std::lock_guard<std::mutex> lk{prefetch_mtx};
+    prefetch_off = lo - map_base;
+    prefetch_len = hi - lo;
+    prefetch_pending = true;
+#else
+    (void)down;
+#endif
+}
+
+//
+// text editing operations
+//
+
+void Melt::insCh(const unsigned x, const unsigned y, char c)
+{
+    if (y < lines.size() && x <= lines[y].length())
+    {
+        pushUndo(UndoRec::OpInsCh, x, y, std::string_view(&c, 1));
+        jnlWrite("I %u %u %c\n", x, y, c);
+        lines[y].mut().insert(x, 1, c);
+        ++edit_gen;
+        search_dirty.insert(y);
+        lex_clean = std::min(lex_clean, static_cast<size_t>(y));
+    }
+}
+
+void Melt::rmCh(const unsigned x, const unsigned y)
+{
+    if (y < lines.size() && x < lines[y].length())
+    {
+        pushUndo(UndoRec::OpRmCh, x, y, lines[y].text().substr(x, 1));
+        jnlWrite("R %u %u\n", x, y);
+        lines[y].mut().erase(x, 1);
+        ++edit_gen;
+        search_dirty.insert(y);
+        lex_clean = std::min(lex_clean, static_cast<size_t>(y));
+    }
+}
+
+void Melt::insLn(const unsigned y, std::string l)
+{
+    if (y <= lines.size())
+    {
+        pushUndo(UndoRec::OpInsLn, 0, y, l);
+        jnlWrite("L %u %.*s\n", y, static_cast<int>(l.length()), l.data());
+        lines.insert(y, Line{std::move(l)});
+        ++edit_gen;
+        ++struct_gen;
+        lex_clean = std::min(lex_clean, static_cast<size_t>(y));
+    }
+}
+
+void Melt::rmLn(const unsigned y)
+{
+    if (y < lines.size())
+    {
+        pushUndo(UndoRec::OpRmLn, 0, y, lines[y].text());
+        jnlWrite("D %u\n", y);
+        lines.erase(y);
+        ++edit_gen;
+        ++struct_gen;
+        lex_clean = std::min(lex_clean, static_cast<size_t>(y));
+    }
+}
+
+void Melt::jnLn(const unsigned y)
+{
+    if (y < lines.size() - 1)
+    {
+        pushUndo(UndoRec::OpJnLn, lines[y].length(), y, {});
+        jnlWrite("J %u\n", y);
+        lines[y].mut().append(lines[y + 1].text());
+        ++edit_gen;
+        search_dirty.insert(y);
+        lex_clean = std::min(lex_clean, static_cast<size_t>(y));
+
+        bool m = undo_mute, jm = journal_mute;
+        undo_mute = journal_mute = true;
+        rmLn(y + 1);
+        undo_mute = m;
+        journal_mute = jm;
+    }
+}
+
+void Melt::spLn(const unsigned x, const unsigned y)
+{
+    if (y < lines.size() && x <= lines[y].length())
+    {
+        pushUndo(UndoRec::OpSpLn, x, y, {});
+        jnlWrite("S %u %u\n", x, y);
+
+        std::string s{lines[y].text().substr(x)};
+        lines[y].mut().erase(x);
+        ++edit_gen;
+        search_dirty.insert(y);
+        lex_clean = std::min(lex_clean, static_cast<size_t>(y));
+
+        bool m = undo_mute, jm = journal_mute;
+        undo_mute = journal_mute = true;
+        insLn(y + 1, s);
+        undo_mute = m;
+        journal_mute = jm;
+    }
+}
+
+//
+// bulk line primitives - a whole block goes through the gap once and costs
+// one undo record, so pasting or deleting thousands of lines doesn't pay
+// per-line bookkeeping. Block payloads are '\n'-joined, matching the yank
+// register and the undo arena slices
+//
+
+void Melt::insLns(const unsigned y, std::string_view joined)
+{
+    // an empty payload is one empty line - that is what a single empty
+    // line joins to, both from a yank and from an OpRmLns undo record
+    if (y > lines.size())
+        return;
+
+    unsigned n = 1;
+    for (size_t p = 0; (p = joined.find('\n', p)) != std::string_view::npos; ++p)
+        ++n;
+    pushUndo(UndoRec::OpInsLns, n, y, joined);
+
+    size_t p = 0;
+    for (unsigned i = 0; i < n; ++i)
+    {
+        size_t e = joined.find('\n', p);
+        size_t span = (e == std::string_view::npos ? joined.length() : e) - p;
+        jnlWrite("L %u %.*s\n", y + i, static_cast<int>(span), joined.data() + p);
+        lines.insert(y + i, Line{std::string{joined.substr(p, span)}});
+        p += span + 1;
+    }
+
+    ++edit_gen;
+    ++struct_gen;
+    lex_clean = std::min(lex_clean, static_cast<size_t>(y));
+}
+
+void Melt::rmLns(const unsigned y, const unsigned n)
+{
+    if (y >= lines.size() || n == 0)
+        return;
+
+    unsigned cnt = std::min<unsigned>(n, lines.size() - y);
+    if (!undo_mute)
+    {
+        std::string joined{};
+        for (unsigned i = 0; i < cnt; ++i)
+        {
+            if (i > 0)
+                joined += '\n';
+            joined.append(lines[y + i].text());
+        }
+        pushUndo(UndoRec::OpRmLns, cnt, y, joined);
+    }
+
+    for (unsigned i = 0; i < cnt; ++i)
+    {
+        jnlWrite("D %u\n", y);
+        lines.erase(y);
+    }
+
+    ++edit_gen;
+    ++struct_gen;
+    lex_clean = std::min(lex_clean, static_cast<size_t>(y));
+}
+
+//
+// replace a whole line in place - one undo record carrying both the old
+// and the new text ('\n'-joined; lines can never contain one)
+//
+
+void Melt::setLn(const unsigned y, std::string_view s)
+{
+    if (y >= lines.size())
+        return;
+
+    if (!undo_mute)
+    {
+        std::string payload{lines[y].text()};
+        payload += '\n';
+        payload.append(s);
+        pushUndo(UndoRec::OpSetLn, 0, y, payload);
+    }
+
+    // journalled as remove-then-insert, which the replay already understands
+    jnlWrite("D %u\n", y);
+    jnlWrite("L %u %.*s\n", y, static_cast<int>(s.length()), s.data());
+
+    lines[y].mut().assign(s);
+    ++edit_gen;
+    search_dirty.insert(y);
+    lex_clean = std::min(lex_clean, static_cast<size_t>(y));
+}
+
+//
+// undo/redo - delta journal over the edit primitives
+//
+
+void Melt::pushUndo(UndoRec::Op op, const unsigned x, const unsigned y, std::string_view payload)
+{
+    if (undo_mute)
+        return;
+
+    // a fresh edit invalidates the redo tail (and its arena slices)
+    if (undo_cursor < undo_log.size())
+    {
+        undo_arena.resize(undo_log[undo_cursor].tpos);
+        undo_log.resize(undo_cursor);
+    }
+
+    // coalesce a run of typed characters into one record, so undoing a word
+    // doesn't take one 'u' per letter
+    if (op == UndoRec::OpInsCh && !undo_log.empty())
+    {
+        UndoRec &last = undo_log.back();
+        if (last.op == UndoRec::OpInsCh && last.y == y && last.x + last.tlen == x && last.grp == undo_grp_open)
+        {
+            undo_arena.append(payload);
+            ++last.tlen;
+            return;
+        }
+    }
+
+    UndoRec r{};
+    r.op = op;
+    r.x = x;
+    r.y = y;
+    r.tpos = undo_arena.size();
+    r.tlen = payload.length();
+    r.grp = undo_grp_open;
+    undo_arena.append(payload);
+
+    undo_log.push_back(r);
+    undo_cursor = undo_log.size();
+}
+
+void Melt::undoOne(const UndoRec &r)
+{
+    switch (r.op)
+    {
+    case UndoRec::OpInsCh:
+        for (size_t i = 0; i < r.tlen; ++i)
+            rmCh(r.x, r.y);
+        break;
+    case UndoRec::OpRmCh:
+        insCh(r.x, r.y, undo_arena[r.tpos]);
+        break;
+    case UndoRec::OpInsLn:
+        rmLn(r.y);
+        break;
+    case UndoRec::OpRmLn:
+        insLn(r.y, std::string{undo_arena, r.tpos, r.tlen});
+        break;
+    case UndoRec::OpJnLn:
+        spLn(r.x, r.y);
+        break;
+    case UndoRec::OpSpLn:
+        jnLn(r.y);
+        break;
+    case UndoRec::OpInsLns:
+        rmLns(r.y, r.x);
+        break;
+    case UndoRec::OpRmLns:
+        insLns(r.y, std::string_view{undo_arena}.substr(r.tpos, r.tlen));
+        break;
+    case UndoRec::OpSetLn:
+    {
+        std::string_view payload = std::string_view{undo_arena}.substr(r.tpos, r.tlen);
+        setLn(r.y, payload.substr(0, payload.find('\n')));
+        break;
+    }
+    }
+}
+
+void Melt::redoOne(const UndoRec &r)
+{
+    switch (r.op)
+    {
+    case UndoRec::OpInsCh:
+        for (size_t i = 0; i < r.tlen; ++i)
+            insCh(r.x + i, r.y, undo_arena[r.tpos + i]);
+        break;
+    case UndoRec::OpRmCh:
+        rmCh(r.x, r.y);
+        break;
+    case UndoRec::OpInsLn:
+        insLn(r.y, std::string{undo_arena, r.tpos, r.tlen});
+        break;
+    case UndoRec::OpRmLn:
+        rmLn(r.y);
+        break;
+    case UndoRec::OpJnLn:
+        jnLn(r.y);
+        break;
+    case UndoRec::OpSpLn:
+        spLn(r.x, r.y);
+        break;
+    case UndoRec::OpInsLns:
+        insLns(r.y, std::string_view{undo_arena}.substr(r.tpos, r.tlen));
+        break;
+    case UndoRec::OpRmLns:
+        rmLns(r.y, r.x);
+        break;
+    case UndoRec::OpSetLn:
+    {
+        std::string_view payload = std::string_view{undo_arena}.substr(r.tpos, r.tlen);
+        setLn(r.y, payload.substr(payload.find('\n') + 1));
+        break;
+    }
+    }
+}
+
+bool Melt::undo()
+{
+    if (undo_cursor == 0)
+        return false;
+
+    // a nonzero group id spans one logical batch - revert it whole
+    const unsigned grp = undo_log[undo_cursor - 1].grp;
+    UndoRec r{};
+    undo_mute = true;
+    do
+    {
+        r = undo_log[--undo_cursor];
+        undoOne(r);
+    } while (grp != 0 && undo_cursor > 0 && undo_log[undo_cursor - 1].grp == grp);
+    undo_mute = false;
+
+    cy = std::min(r.y, static_cast<unsigned>(lines.size() - 1));
+    cx = std::min(r.x, static_cast<unsigned>(lines[cy].length()));
+    scrollToFit();
+    return true;
+}
+
+bool Melt::redo()
+{
+    if (undo_cursor >= undo_log.size())
+        return false;
+
+    const unsigned grp = undo_log[undo_cursor].grp;
+    UndoRec r{};
+    undo_mute = true;
+    do
+    {
+        r = undo_log[undo_cursor++];
+        redoOne(r);
+    } while (grp != 0 && undo_cursor < undo_log.size() && undo_log[undo_cursor].grp == grp);
+    undo_mute = false;
+
+    cy = std::min(r.y, static_cast<unsigned>(lines.size() - 1));
+    cx = std::min(r.x, static_cast<unsigned>(lines[cy].length()));
+    scrollToFit();
+    return true;
+}
+
+//
+// search - trigram index built off the UI thread, consulted by findMatch
+//
+
+void Melt::kickIndexBuild()
 {
-    try
-    {
-        Melt med{};
-
-        med.init(argc, argv);
-        med.run();
-        med.shutdown();
-    }
-    catch (const std::runtime_error &e)
-    {
-        std::printf("Fatal error: %s", (e.what() == nullptr ? "unknown error!" : e.what()));
-        return -1;
-    }
-    catch (...)
+    const void *live = nullptr;
     {
-        std::printf("Failed due to unknown error!");
-        return -1;
+        std::lock_guard<std::mutex> lk{index_mtx};
+        if (index_building)
+            return;
+        live = search_index.get();
     }
+    if (index_thread.joinable())
+        index_thread.join();
 
-    return 0;
-}
+    index_building = true;
 
-//
-//
-// +-----------------------------+
-// | Core methods implementation |
-// +-----------------------------+
-//
-//
+    // the snapshot below captures the dirty lines' current content, but
+    // the live index was built without them - park them instead of
+    // dropping them, so searches during the build window still see them
+    if (live != index_pending_base)
+        index_dirty_pending.clear();
+    index_dirty_pending.insert(index_dirty_pending.end(), search_dirty.begin(), search_dirty.end());
+    index_pending_base = live;
+    search_dirty.clear();
+
+    index_thread = std::thread([this, snap = lines.snapshot(), gen = struct_gen, epoch = buf_epoch]() {
+        auto idx = std::make_shared<SearchIndex>();
+        idx->gen = gen;
+        idx->epoch = epoch;
+
+        for (unsigned i = 0; i < snap.size(); ++i)
+        {
+            std::string_view t = snap[i].text();
+            for (size_t j = 0; j + 3 <= t.length(); ++j)
+            {
+                auto &v = idx->tri[SearchIndex::key(t, j)];
+                if (v.empty() || v.back() != i)
+                    v.push_back(i);
+            }
+        }
+
+        std::lock_guard<std::mutex> lk{index_mtx};
+        search_index = std::move(idx);
+        index_building = false;
+    });
+}
 
 //
-// initialization and cleanup handling
+// first occurrence of term at or after (fy, fx), wrapping past the end;
+// candidate lines come from the index when it is current, otherwise the
+// buffer is scanned directly
 //
 
-void Melt::init(int argc, char **argv)
+std::optional<std::pair<unsigned, unsigned>> Melt::findMatch(std::string_view term, const unsigned fy,
+                                                             const unsigned fx)
 {
-    // file operations
-    lines.push_back("");
+    if (term.empty() || lines.empty())
+        return std::nullopt;
 
-    auto fback = [this](std::string msg = "") -> void {
-        fname.clear();
-        fstate = 0;
-        smessage = std::move(msg);
+    auto scanFrom = [&](unsigned y, size_t from) -> std::optional<std::pair<unsigned, unsigned>> {
+        size_t p = lines[y].text().find(term, from);
+        if (p == std::string_view::npos)
+            return std::nullopt;
+        return {{y, static_cast<unsigned>(p)}};
     };
 
-    if (argc > 1)
+    std::shared_ptr<const SearchIndex> idx{};
     {
-        fname = argv[1];
-        fstate = 1;
-        if (fname.empty())
-            fback();
-        else if (!valFn(fname))
-            fback("Invalid filename!");
-        else if (fsystem::path p = fname; !fsystem::exists(fname))
-            fstate = 0;
-        else if (auto r = load(fname); r.has_value())
-            fback(r.value());
+        std::lock_guard<std::mutex> lk{index_mtx};
+        idx = search_index;
     }
-    else
-        fback();
-
-    // initialize curses
-    if (initscr() == nullptr)
-        throw std::runtime_error{"Curses initialization failed!"};
 
-    // disable line-buffering and special key detection
-    cCheck(raw());
-    cCheck(keypad(stdscr, true));
-    cCheck(noecho());
+    // parked dirty lines only matter while the index they were collected
+    // against is still the live one; a newer install absorbed them
+    if (!index_dirty_pending.empty() && idx.get() != index_pending_base)
+        index_dirty_pending.clear();
 
-    curs_set(1);
+    if (idx != nullptr && idx->gen == struct_gen && idx->epoch == buf_epoch && term.length() >= 3)
+    {
+        // pick the rarest trigram of the term as the candidate generator
+        const std::vector<unsigned> *cand = nullptr;
+        for (size_t j = 0; j + 3 <= term.length(); ++j)
+        {
+            auto it = idx->tri.find(SearchIndex::key(term, j));
+            if (it == idx->tri.end())
+            {
+                cand = nullptr;
+                break;
+            }
+            if (cand == nullptr || it->second.size() < cand->size())
+                cand = &it->second;
+        }
 
-    start_color();
-    init_pair(1, COLOR_BLACK, COLOR_WHITE);
+        // candidates, plus every line edited since the index was built
+        std::vector<unsigned> cs{};
+        if (cand != nullptr)
+            cs = *cand;
+        cs.insert(cs.end(), search_dirty.begin(), search_dirty.end());
+        cs.insert(cs.end(), index_dirty_pending.begin(), index_dirty_pending.end());
+        std::sort(cs.begin(), cs.end());
+        cs.erase(std::unique(cs.begin(), cs.end()), cs.end());
 
-    getmaxyx(stdscr, my, mx);
-    ax = mx;
-    ay = my - 2;
+        auto tryLine = [&](unsigned y) -> std::optional<std::pair<unsigned, unsigned>> {
+            if (y >= lines.size())
+                return std::nullopt;
+            return scanFrom(y, (y == fy ? fx : 0));
+        };
 
-    if (ax < 40 || ay < 12)
-        throw std::runtime_error{"Terminal size too small!"};
+        auto at = std::lower_bound(cs.begin(), cs.end(), fy);
+        for (auto it = at; it != cs.end(); ++it)
+            if (auto m = tryLine(*it); m.has_value())
+                return m;
+        for (auto it = cs.begin(); it != at; ++it)
+            if (auto m = tryLine(*it); m.has_value())
+                return m;
+        return std::nullopt;
+    }
 
-    back.resize(ay, std::string(ax, ' '));
-    front.resize(ay, std::string(ax, ' '));
+    // index missing or stale: fall back to a direct scan and start a
+    // rebuild. A current index that merely can't serve this term (shorter
+    // than a trigram) needs no rebuild
+    if (idx == nullptr || idx->gen != struct_gen || idx->epoch != buf_epoch)
+        kickIndexBuild();
 
-    // force initial redraw
-    is_ws_changed = true;
+    for (unsigned y = fy; y < lines.size(); ++y)
+        if (auto m = scanFrom(y, (y == fy ? fx : 0)); m.has_value())
+            return m;
+    for (unsigned y = 0; y < fy; ++y)
+        if (auto m = scanFrom(y, 0); m.has_value())
+            return m;
+    return std::nullopt;
 }
 
-void Melt::shutdown() { endwin(); }
-
 //
-// file I/O
+// read a line of input on the message row; returns nullopt on ESC
 //
 
-std::optional<std::string> Melt::load(std::string_view fn)
+std::optional<std::string> Melt::linePrompt(std::string_view label)
 {
-    if (fn.empty())
-        return {"Empty filename!"};
-    std::ifstream f;
+    nodelay(stdscr, false);
 
-    f.open(fn);
-    if (!f.is_open())
-        return {"Failed to open " + std::string(fn) + " for reading!"};
-    lines.clear();
+    smessage.assign(label);
+    smessage.resize(mx, ' ');
+    mvaddnstr(my - 1, 0, smessage.data(), smessage.length());
+    move(my - 1, label.length());
 
-    std::string s{};
-    while (std::getline(f, s))
-    {
-        lines.push_back(s);
-    }
-    if (f.bad() || (!f.eof() && f.fail()))
+    std::string fn{};
+    while (true)
     {
-        lines.clear();
-        lines.push_back("");
-        return {"Failed to read from " + std::string(fn) + " due to unknown error!"};
+        int chr = getch();
+        switch (chr)
+        {
+        case KEY_ENTER:
+        case 10:
+        case 13:
+            return fn;
+        case 27:
+            return std::nullopt;
+        case KEY_BACKSPACE:
+        case 127:
+        case 8:
+            if (!fn.empty())
+            {
+                fn.pop_back();
+                mvdelch(my - 1, label.length() + fn.length());
+            }
+            break;
+        default:
+            if (chr >= 32 && chr <= 126)
+            {
+                fn += static_cast<char>(chr);
+                addch(chr);
+            }
+            break;
+        }
+        move(my - 1, label.length() + fn.length());
     }
-
-    f.close();
-
-    if (lines.empty())
-        lines.push_back("");
-    return std::nullopt;
 }
 
-std::optional<std::string> Melt::save(std::string_view fn)
+//
+// interactive search prompt - the viewport follows the first match while
+// the term is typed; ENTER keeps the position, ESC restores it
+//
+
+void Melt::searchPrompt()
 {
-    if (fn.empty())
-        return {"Empty filename!"};
-    std::ofstream f;
+    nodelay(stdscr, false);
 
-    f.open(fn);
-    if (!f.is_open())
-        return {"Failed to open " + std::string(fn) + " for writing!"};
+    const unsigned scy = cy, scx = cx, soy = oy, sox = ox;
+    std::string term{};
+    bool accepted = false;
 
-    for (const auto &l : lines)
-        f << l << "\n";
+    int chr = 0;
+    while (chr != 27)
+    {
+        update();
+        render();
 
-    f.close();
+        smessage.assign("Search: ");
+        smessage.append(term);
+        smessage.resize(mx, ' ');
+        mvaddnstr(my - 1, 0, smessage.data(), smessage.length());
+        move(my - 1, 8 + term.length());
+        refresh();
 
-    return std::nullopt;
+        chr = getch();
+        switch (chr)
+        {
+        case KEY_ENTER:
+        case 10:
+        case 13:
+            accepted = !term.empty();
+            chr = 27;
+            break;
+        case KEY_BACKSPACE:
+        case 127:
+        case 8:
+            if (!term.empty())
+                term.pop_back();
+            break;
+        default:
+            if (chr >= 32 && chr <= 126)
+                term += static_cast<char>(chr);
+            break;
+        }
+
+        if (!term.empty())
+        {
+            if (auto m = findMatch(term, scy, scx); m.has_value())
+            {
+                cy = m->first;
+                cx = m->second;
+                scrollToFit();
+            }
+        }
+    }
+
+    if (accepted)
+    {
+        last_search = term;
+        smessage.clear();
+    }
+    else
+    {
+        cy = scy;
+        cx = scx;
+        oy = soy;
+        ox = sox;
+        smessage.clear();
+    }
 }
 
 //
-// text editing operations
+// regex replace-all - workers scan disjoint chunks of a snapshot and only
+// produce the lines that actually change; the results are applied back in
+// one batched pass under a single undo group
 //
 
-void Melt::insCh(const unsigned x, const unsigned y, char c)
+void Melt::replaceRegex(const std::string &pat, const std::string &repl)
 {
-    if (y < lines.size() && x <= lines[y].length())
-        lines[y].insert(x, 1, c);
-}
+    std::regex re{};
+    try
+    {
+        re = std::regex{pat, std::regex::ECMAScript | std::regex::optimize};
+    }
+    catch (const std::regex_error &)
+    {
+        smessage = "Bad pattern: " + pat;
+        return;
+    }
 
-void Melt::rmCh(const unsigned x, const unsigned y)
-{
-    if (y < lines.size() && x < lines[y].length())
-        lines[y].erase(x, 1);
-}
+    const auto snap = lines.snapshot();
 
-void Melt::insLn(const unsigned y, std::string l)
-{
-    if (y <= lines.size())
-        lines.insert(lines.begin() + y, std::move(l));
-}
+    auto scanRange = [&re, &repl, &snap](size_t from, size_t to, std::vector<std::pair<unsigned, std::string>> &out) {
+        for (size_t i = from; i < to; ++i)
+        {
+            std::string_view t = snap[i].text();
+            if (!std::regex_search(t.begin(), t.end(), re))
+                continue;
+            std::string r{};
+            std::regex_replace(std::back_inserter(r), t.begin(), t.end(), re, repl);
+            if (r != t)
+                out.emplace_back(static_cast<unsigned>(i), std::move(r));
+        }
+    };
 
-void Melt::rmLn(const unsigned y)
-{
-    if (y < lines.size())
-        lines.erase(lines.begin() + y);
-}
+    // matching dominates the cost, so fan the scan out like the load path;
+    // small buffers aren't worth the thread spawns
+    size_t nthreads = std::max(1u, std::thread::hardware_concurrency());
+    if (snap.size() < 16384)
+        nthreads = 1;
+    nthreads = std::min(nthreads, std::max<size_t>(1, snap.size()));
 
-void Melt::jnLn(const unsigned y)
-{
-    if (y < lines.size() - 1)
+    std::vector<std::vector<std::pair<unsigned, std::string>>> parts(nthreads);
+    if (nthreads == 1)
+        scanRange(0, snap.size(), parts[0]);
+    else
     {
-        lines[y] += lines[y + 1];
-        rmLn(y + 1);
+        std::vector<std::thread> workers{};
+        size_t chunk = snap.size() / nthreads;
+        for (size_t t = 0; t < nthreads; ++t)
+        {
+            size_t from = t * chunk;
+            size_t to = (t + 1 == nthreads ? snap.size() : from + chunk);
+            workers.emplace_back(scanRange, from, to, std::ref(parts[t]));
+        }
+        for (auto &w : workers)
+            w.join();
     }
-}
 
-void Melt::spLn(const unsigned x, const unsigned y)
-{
-    if (y < lines.size() && x <= lines[y].length())
+    size_t hits = 0;
+    undo_grp_open = undo_grp_next++;
+    for (const auto &part : parts)
+        for (const auto &[y, text] : part)
+        {
+            setLn(y, text);
+            ++hits;
+        }
+    undo_grp_open = 0;
+
+    if (hits == 0)
     {
-        std::string s = lines[y].substr(x);
-        lines[y].erase(x);
-        insLn(y + 1, s);
+        smessage = "Pattern not found: " + pat;
+        return;
     }
+    fstate = 2;
+    smessage = "Replaced in " + std::to_string(hits) + " line(s)";
 }
 
 //
@@ -331,6 +2801,20 @@ void Melt::mvCursor(int xd, int yd)
             ++ny;
     }
 
+    // never rest inside a UTF-8 sequence - carry on in the direction of
+    // travel until the next code-point boundary (ASCII lines skip this)
+    if (ny < static_cast<int>(lines.size()) && lines[ny].multibyte())
+    {
+        std::string_view t = lines[ny].text();
+        if (xd >= 0)
+            while (nx < static_cast<int>(t.length()) && (static_cast<unsigned char>(t[nx]) & 0xC0) == 0x80)
+                ++nx;
+        else
+            while (nx > 0 && nx < static_cast<int>(t.length()) &&
+                   (static_cast<unsigned char>(t[nx]) & 0xC0) == 0x80)
+                --nx;
+    }
+
     cx = static_cast<unsigned>(nx);
     cy = static_cast<unsigned>(ny);
     scrollToFit();
@@ -339,15 +2823,17 @@ void Melt::mvCursor(int xd, int yd)
 void Melt::scrollToFit()
 {
     unsigned d = 1;
-    // horizontal
-    if (cx < ox)
+    // horizontal - ox is a visual column, so translate the cursor's byte
+    // column through the tab table before comparing
+    unsigned vcx = (cy < lines.size() ? static_cast<unsigned>(visualColOf(lines[cy], cx)) : cx);
+    if (vcx < ox)
     {
-        d = ox - cx;
+        d = ox - vcx;
         scrollLeft(d);
     }
-    else if (cx >= ox + ax)
+    else if (vcx >= ox + ax)
     {
-        d = cx - (ox + ax) + 1;
+        d = vcx - (ox + ax) + 1;
         scrollRight(d);
     }
 
@@ -389,13 +2875,15 @@ void Melt::scrollRight(unsigned d)
     if (front.empty())
         return;
 
-    // find maximum line length among visible lines
+    // find maximum visual line length among visible lines - goes through
+    // the tab checkpoint cache so huge lines are never expanded for this
     int max_length = 0;
     for (size_t i = 0; i < front.size() && i + oy < lines.size(); ++i)
     {
         size_t idx = i + oy;
         if (idx < lines.size())
-            max_length = std::max(max_length, static_cast<int>(visualLength(lines[idx])));
+            max_length =
+                std::max(max_length, static_cast<int>(visualColOf(lines[idx], lines[idx].length())));
     }
 
     if (ox + d < static_cast<unsigned>(max_length))
@@ -408,7 +2896,84 @@ void Melt::scrollRight(unsigned d)
 
 void Melt::processEvents()
 {
+    // while a background save is in flight or a file is being followed,
+    // poll instead of blocking so updates show up without a keypress
+    if (save_busy || follow_on)
+        timeout(100);
+
+    // block for the first key, then drain everything already queued (paste,
+    // key auto-repeat) and apply the whole batch before the next render -
+    // a 10k-line paste costs one repaint instead of 10k
     int ch = getch();
+    timeout(-1);
+#ifdef MELT_PERF
+    const auto pt0 = std::chrono::steady_clock::now();
+    const bool had_key = (ch != ERR);
+#endif
+    if (ch != ERR)
+        handleKey(ch);
+
+    nodelay(stdscr, true);
+    while ((ch = getch()) != ERR)
+        handleKey(ch);
+    nodelay(stdscr, false);
+
+#ifdef MELT_PERF
+    // one sample per batch, so a 10k-key paste counts as one keystroke just
+    // like it costs one repaint
+    if (had_key)
+        perf_key.push(static_cast<uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - pt0).count()));
+#endif
+}
+
+//
+// recognize the bracketed-paste open/close sequences (ESC [ 200~ / 201~)
+// after a raw ESC; unread anything that is not one of them
+//
+
+bool Melt::checkPasteToggle()
+{
+    nodelay(stdscr, true);
+
+    // raw ints, not chars: a keypad key queued right behind the ESC (e.g.
+    // KEY_DOWN) must survive the round trip through ungetch untruncated
+    int seq[5] = {};
+    int got = 0;
+    for (; got < 5; ++got)
+    {
+        int c = getch();
+        if (c == ERR)
+            break;
+        seq[got] = c;
+    }
+
+    if (got == 5 && seq[0] == '[' && seq[1] == '2' && seq[2] == '0' && seq[4] == '~')
+    {
+        if (seq[3] == '0')
+        {
+            in_paste = true;
+            return true;
+        }
+        if (seq[3] == '1')
+        {
+            in_paste = false;
+            return true;
+        }
+    }
+
+    // not a paste marker - push the bytes back for normal processing
+    while (got > 0)
+        ungetch(seq[--got]);
+    return false;
+}
+
+void Melt::handleKey(int ch)
+{
+    // the keys that start recording never see macro_rec set, and the ones
+    // that stop it are stripped again in processCmd
+    if (macro_rec)
+        macro_keys.push_back(ch);
 
     switch (ch)
     {
@@ -446,7 +3011,7 @@ void Melt::processEvents()
     case 127:
     case 8:
         // BACKSPACE key
-        if (edmode == 0)
+        if (edmode == 0 && !pager_on)
         {
             if (cx == 0 && cy > 0)
             {
@@ -457,6 +3022,12 @@ void Melt::processEvents()
             }
             else if (cx > 0)
             {
+                // take the whole code point, not just its last byte
+                while (cx > 1 && (static_cast<unsigned char>(lines[cy].text()[cx - 1]) & 0xC0) == 0x80)
+                {
+                    rmCh(cx - 1, cy);
+                    mvCursor(-1, 0);
+                }
                 rmCh(cx - 1, cy);
                 mvCursor(-1, 0);
             }
@@ -467,7 +3038,7 @@ void Melt::processEvents()
     case 10:
     case 13:
         // ENTER key
-        if (edmode == 0)
+        if (edmode == 0 && !pager_on)
         {
             spLn(cx, cy);
             mvCursor(-lines[cy].length(), 1);
@@ -482,7 +3053,7 @@ void Melt::processEvents()
         break;
     case 9:
         // TAB key
-        if (edmode == 0)
+        if (edmode == 0 && !pager_on)
         {
             for (int i = 0; i < 4; ++i) insCh(cx, cy, ' ');
             mvCursor(4, 0);
@@ -490,22 +3061,42 @@ void Melt::processEvents()
         }
         break;
     case 27:
-        // ESC key
+        // ESC key - may be the start of a paste marker rather than a keypress
+        // (never during replay, which must not eat real queued input)
+        if (!macro_play && checkPasteToggle())
+            break;
+        // between the paste markers every byte is pasted data - a raw ESC
+        // must not flip into command mode and swallow the rest as commands
+        if (in_paste)
+            break;
         if (edmode == 0)
             edmode = 1;
         else if (edmode == 1)
             edmode = 0;
-            cmd.clear();
+        cmd.clear();
         break;
     default:
-        if (ch >= 32 && ch <= 126)
+        // printable ASCII plus raw UTF-8 bytes - a multibyte character
+        // arrives as consecutive keys and is inserted byte by byte
+        if ((ch >= 32 && ch <= 126) || (ch >= 128 && ch <= 255))
         {
             if (edmode == 0)
             {
-                // basic characters
-                insCh(cx, cy, ch);
-                mvCursor(1, 0);
-                fstate = 2;
+                if (pager_on)
+                {
+                    // pager navigation: space/b page like less(1)
+                    if (ch == ' ')
+                        mvCursor(0, ay);
+                    else if (ch == 'b')
+                        mvCursor(0, -static_cast<int>(ay));
+                }
+                else
+                {
+                    // basic characters
+                    insCh(cx, cy, ch);
+                    mvCursor(1, 0);
+                    fstate = 2;
+                }
             }
             else if (edmode == 1)
                 cmd += ch;
@@ -525,83 +3116,241 @@ void Melt::processCmd(std::string_view c)
 
     for (auto ch : c)
     {
+        if (pager_on && (ch == 's' || ch == 'w' || ch == 'u' || ch == 'r' || ch == 'd' || ch == 'x' || ch == 'p' ||
+                         ch == '%'))
+        {
+            smessage = "Read-only (pager mode)!";
+            continue;
+        }
+
         if (ch == '.')
             processCmd(last_cmd);
         else if (ch == 's')
+            saveAsync(fname);
+        else if (ch == 'w')
+        {
+            if (auto fn = linePrompt("Write file: "); fn.has_value())
+            {
+                if (fn->empty())
+                    smessage = "Empty filename!";
+                else if (!valFn(*fn))
+                    smessage = "Invalid filename!";
+                else
+                {
+                    jnlClose();
+                    fname = *fn;
+                    updateHlMode();
+                    saveAsync(fname);
+                }
+            }
+        }
+        else if (ch == 'e')
+        {
+            if (auto fn = linePrompt("Open file: "); fn.has_value())
+            {
+                if (fn->empty())
+                    smessage = "Empty filename!";
+                else if (!valFn(*fn))
+                    smessage = "Invalid filename!";
+                else
+                    openBuffer(*fn);
+            }
+        }
+        else if (ch == 'b')
+        {
+            if (bufs.size() < 2)
+                smessage = "No other buffers!";
+            else
+                switchTo((cur_buf + 1) % bufs.size());
+        }
+        else if (ch == 'f')
+        {
+            if (follow_on)
+            {
+                stopFollow();
+                smessage = "Stopped following " + fname;
+            }
+            else if (fname.empty())
+                smessage = "No file to follow!";
+            else
+            {
+                startFollow();
+                smessage = "Following " + fname;
+            }
+        }
+        else if (ch == 'q')
+        {
+            bool any_dirty = (fstate == 2);
+            for (size_t i = 0; i < bufs.size(); ++i)
+                if (i != cur_buf && bufs[i]->fstate == 2)
+                    any_dirty = true;
+
+            if (any_dirty) smessage = "No write since last change (use Q to override)!";
+            else
+            {
+                saveSession();
+                is_running = false;
+            }
+        }
+        else if (ch == 'Q')
+        {
+            saveSession();
+            is_running = false;
+        }
+        else if (ch == '/')
+            searchPrompt();
+        else if (ch == '%')
+        {
+            if (auto pat = linePrompt("Replace regex: "); pat.has_value() && !pat->empty())
+            {
+                if (auto repl = linePrompt("Replacement: "); repl.has_value())
+                    replaceRegex(*pat, *repl);
+            }
+        }
+        else if (ch == 'n')
+        {
+            if (last_search.empty())
+                smessage = "No previous search!";
+            else if (auto m = findMatch(last_search, cy, cx + 1); m.has_value())
+            {
+                cy = m->first;
+                cx = m->second;
+                scrollToFit();
+            }
+            else
+                smessage = "Pattern not found: " + last_search;
+        }
+        else if (ch == 'u')
+        {
+            if (undo())
+                fstate = 2;
+            else
+                smessage = "Nothing to undo!";
+        }
+        else if (ch == 'r')
+        {
+            if (redo())
+                fstate = 2;
+            else
+                smessage = "Nothing to redo!";
+        }
+        else if (ch == 'd')
         {
-            if (auto ret = save(fname); ret.has_value())
-                smessage = ret.value();
+            if (cy > 0)
+            {
+                rmLn(cy);
+                mvCursor(0, -1);
+                fstate = 2;
+            }
             else
+                smessage = "Only one line left!";
+        }
+        else if (ch == 'v')
+        {
+            sel_on = !sel_on;
+            if (sel_on)
             {
-                smessage = "Successfully written to " + fname;
-                fstate = 1;
+                sel_anchor = cy;
+                smessage = "Selecting lines (v to cancel, y to yank, x to delete)";
             }
+            else
+                smessage.clear();
         }
-        else if (ch == 'w')
+        else if (ch == 'y' || ch == 'x')
         {
-            smessage = "Write file: ";
-            smessage.resize(mx, ' ');
-            mvprintw(my - 1, 0, escPercent(smessage).c_str());
-            move(my - 1, 12);
+            unsigned lo = sel_on ? std::min(sel_anchor, cy) : cy;
+            unsigned hi = sel_on ? std::max(sel_anchor, cy) : cy;
+            sel_on = false;
+
+            yank_buf.clear();
+            for (unsigned i = lo; i <= hi; ++i)
+            {
+                if (i > lo)
+                    yank_buf += '\n';
+                yank_buf.append(lines[i].text());
+            }
+            yank_count = hi - lo + 1;
 
-            std::string fn{};
-            char chr = 0;
-            while (chr != 27)
+            if (ch == 'x')
             {
-                chr = getch();
-                switch (chr) 
+                // the buffer always keeps at least one line, like 'd' does
+                unsigned cnt = yank_count;
+                if (cnt >= lines.size())
                 {
-                case KEY_ENTER:
-                case 10:
-                case 13:
-                    if (fn.empty())
-                        smessage = "Empty filename!";
-                    else if (!valFn(fn))
-                        smessage = "Invalid filename!";
-                    else if (auto ret = save(fn); ret.has_value())
-                        smessage = ret.value();
-                    else
-                    {
-                        fname = fn;
-                        smessage = "Successfully written to " + fname;
-                        fstate = 1;
-                    }
-                    chr = 27;
-                    break;
-                case KEY_BACKSPACE:
-                case 127:
-                case 8:
-                    fn = fn.substr(0, fn.length() - 1);
-                    mvdelch(my - 1, 12 + fn.length());
-                    break;
-                default:
-                    if (chr >= 32 && chr <= 126)
-                    {
-                        fn += chr;
-                        addch(chr);
-                    }
-                    break;
+                    cnt = lines.size() - 1;
+                    smessage = "Kept the last line!";
                 }
-                move(my - 1, 12 + fn.length());
+                rmLns(lo, cnt);
+                cy = std::min(lo, static_cast<unsigned>(lines.size() - 1));
+                cx = std::min(cx, static_cast<unsigned>(lines[cy].length()));
+                scrollToFit();
+                fstate = 2;
+                if (cnt == yank_count)
+                    smessage = "Deleted " + std::to_string(cnt) + " line(s)";
             }
+            else
+                smessage = "Yanked " + std::to_string(yank_count) + " line(s)";
         }
-        else if (ch == 'q')
+        else if (ch == 'p')
         {
-            if (fstate == 2) smessage = "No write since last change (use Q to override)!";
-            else is_running = false;
+            if (yank_count == 0)
+                smessage = "Nothing yanked!";
+            else
+            {
+                insLns(cy + 1, yank_buf);
+                cy = cy + 1;
+                cx = 0;
+                scrollToFit();
+                fstate = 2;
+                smessage = "Pasted " + std::to_string(yank_count) + " line(s)";
+            }
         }
-        else if (ch == 'Q')
-            is_running = false;
-        else if (ch == 'd')
+        else if (ch == 'm')
         {
-            if (cy > 0)
+            if (macro_play)
+                continue;
+            if (!macro_rec)
             {
-                rmLn(cy);
-                mvCursor(0, -1);
-                fstate = 2;
+                macro_keys.clear();
+                macro_rec = true;
+                smessage = "Recording macro (ESC m to stop)";
             }
             else
-                smessage = "Only one line left!";
+            {
+                macro_rec = false;
+                // drop the ESC + command + ENTER keys that stopped us
+                size_t strip = std::min(macro_keys.size(), c.length() + 2);
+                macro_keys.resize(macro_keys.size() - strip);
+                smessage = "Recorded " + std::to_string(macro_keys.size()) + " key(s)";
+            }
+        }
+        else if (ch == '@')
+        {
+            if (macro_rec)
+                smessage = "Still recording!";
+            else if (macro_keys.empty())
+                smessage = "No macro recorded!";
+            else if (auto cnt = linePrompt("Repeat count: "); cnt.has_value())
+            {
+                unsigned n = cnt->empty() ? 1 : static_cast<unsigned>(std::strtoul(cnt->c_str(), nullptr, 10));
+                if (n == 0)
+                    smessage = "Nothing to do!";
+                else
+                    replayMacro(n);
+            }
+        }
+        else if (ch == '?')
+        {
+#ifdef MELT_PERF
+            hud_on = !hud_on;
+            if (!hud_on)
+                smessage.clear();
+            // the HUD text is only composed inside update(), which nothing
+            // else schedules here - force the next frame through
+            frame_valid = false;
+#else
+            smessage = "Not a perf build (make perf)!";
+#endif
         }
         else
         {
@@ -612,56 +3361,218 @@ void Melt::processCmd(std::string_view c)
     last_cmd = cmd;
 }
 
+//
+// macro replay - feed the recorded keys back through handleKey N times.
+// No frame is produced until the whole batch is applied, and every edit
+// lands in one undo group, so the entire replay reverts with one 'u'
+//
+
+void Melt::replayMacro(const unsigned n)
+{
+    macro_play = true;
+    const unsigned prev_grp = undo_grp_open;
+    if (prev_grp == 0)
+        undo_grp_open = undo_grp_next++;
+
+    for (unsigned i = 0; i < n; ++i)
+        for (int k : macro_keys)
+            handleKey(k);
+
+    undo_grp_open = prev_grp;
+    macro_play = false;
+
+    scrollToFit();
+    smessage = "Replayed macro " + std::to_string(n) + " time(s)";
+}
+
 //
 // rendering - use double buffer technique
 //
 
+// lines at or above this many bytes take the windowed extraction path
+// instead of the cached-full-expansion one
+inline constexpr size_t LONG_LINE_MIN = 1 << 12;
+
+//
+// frame scheduler - a frame is composed only when something it would show
+// has changed since the last one was presented. Background work (saves,
+// follow mode, loads) forces frames so completions surface promptly
+//
+
+bool Melt::framePending()
+{
+    if (is_ws_changed || save_busy || follow_on || !frame_valid)
+        return true;
+
+    {
+        std::lock_guard<std::mutex> lk{load_mtx};
+        if (loading_buf != nullptr)
+            return true;
+    }
+
+    // resizes arrive as events too, but are cheap to double-check here
+    unsigned nx, ny;
+    getmaxyx(stdscr, ny, nx);
+    if (nx != mx || ny != my)
+        return true;
+
+    return last_frame.edit_gen != edit_gen || last_frame.struct_gen != struct_gen ||
+           last_frame.buf_epoch != buf_epoch || last_frame.cx != cx || last_frame.cy != cy ||
+           last_frame.ox != ox || last_frame.oy != oy || last_frame.fstate != fstate ||
+           last_frame.sel_on != sel_on || last_frame.sel_anchor != sel_anchor || last_frame.smessage != smessage;
+}
+
 void Melt::update()
 {
-    // check for window size changes
+    pollSave();
+    pollLoad();
+    pollFollow();
+
+    if (pager_on && oy != prefetch_last_oy)
+    {
+        postPrefetch(oy > prefetch_last_oy);
+        prefetch_last_oy = oy;
+    }
+
+    // check for window size changes; a gutter that needs another digit
+    // resizes the text area the same way a terminal resize would
     unsigned nx, ny;
     getmaxyx(stdscr, ny, nx);
-    if (mx != nx || my != ny)
+    unsigned ngut = gutterWidthFor(lines.size());
+    if (mx != nx || my != ny || gut_w != ngut)
     {
         is_ws_changed = true;
         mx = nx;
         my = ny;
-        ax = mx;
+        gut_w = ngut;
+        ax = mx - gut_w;
         ay = my - 2;
 
         if (ax < 40 || ay < 12)
             throw std::runtime_error{"Terminal size too small!"};
 
-        back.resize(ay, std::string(ax, ' '));
-        front.resize(ay, std::string(ax, ' '));
+        back.assign(ay, std::string(ax, ' '));
+        front.assign(ay, std::string(ax, ' '));
+        back_attr.assign(ay, std::string(ax, '\0'));
+        front_attr.assign(ay, std::string(ax, '\0'));
     }
 
-    auto getVisible = [this](std::string s) -> std::string {
-        std::string estr = expandTabs(std::move(s));
-        std::string vis = std::string(ax, ' ');
+    // bring the lexer-state chain up to the bottom of the viewport; when
+    // nothing changed since the last frame this is a no-op
+    if (hl_on)
+        ensureLexed(static_cast<size_t>(oy) + ay);
+
+    // fill a row in place - back[i] keeps its capacity across frames, so the
+    // steady-state frame path does no heap allocation at all
+    auto fillVisible = [this](Line &l, std::string &row, std::string &arow) -> void {
+        // very long lines never materialize their full expansion - the
+        // visible window is extracted directly via the tab checkpoints
+        if (l.length() >= LONG_LINE_MIN)
+        {
+            fillVisibleLong(l, row);
+            arow.assign(ax, '\0');
+            return;
+        }
+
+        const std::string &estr = expandedOf(l);
         if (estr.length() > ox)
         {
             size_t cp_len = std::min(static_cast<size_t>(ax), estr.length() - ox);
-            vis.assign(estr, ox, cp_len);
-            if (cp_len < static_cast<size_t>(ax))
-                vis.resize(ax, ' ');
+            row.assign(estr, ox, cp_len);
+            if (hl_on && l.attrs.length() == estr.length())
+                arow.assign(l.attrs, ox, cp_len);
+            else
+                arow.clear();
+        }
+        else
+        {
+            row.clear();
+            arow.clear();
         }
-        return vis;
+        row.resize(ax, ' ');
+        arow.resize(ax, '\0');
     };
 
+    // selection bounds for the overlay below; a change in the highlighted
+    // range forces rows to recompose so stale overlay cells can't linger
+    size_t sel_lo = sel_on ? std::min(sel_anchor, cy) : ~static_cast<size_t>(0);
+    size_t sel_hi = sel_on ? std::max(sel_anchor, cy) : ~static_cast<size_t>(0);
+
+    // strictly viewport-scoped and change-driven: a row is recomposed only
+    // when it maps to a different line (scroll), the line was edited, the
+    // horizontal offset moved, or the whole screen is invalid
+    bool all_dirty = is_ws_changed || ox != last_row_ox || struct_gen != last_struct_gen || row_line.size() != ay ||
+                     sel_lo != last_sel_lo || sel_hi != last_sel_hi;
+    if (row_line.size() != ay)
+    {
+        row_line.assign(ay, ~static_cast<size_t>(0));
+        row_rev.assign(ay, 0);
+    }
+
     for (size_t i = 0; i < ay; ++i)
     {
-        if (i + static_cast<size_t>(oy) < lines.size())
-            back[i] = getVisible(lines[i + static_cast<size_t>(oy)]);
+        size_t li = i + static_cast<size_t>(oy);
+        if (li < lines.size())
+        {
+            Line &l = lines[li];
+            if (!all_dirty && row_line[i] == li && row_rev[i] == l.rev)
+                continue;
+            fillVisible(l, back[i], back_attr[i]);
+            if (li >= sel_lo && li <= sel_hi)
+                back_attr[i].assign(ax, HL_SELECT);
+            row_line[i] = li;
+            row_rev[i] = l.rev;
+        }
         else
-            back[i] = "~" + std::string(ax - 1, ' ');
+        {
+            if (!all_dirty && row_line[i] == ~static_cast<size_t>(0))
+                continue;
+            back[i].assign(1, '~');
+            back[i].resize(ax, ' ');
+            back_attr[i].assign(ax, '\0');
+            row_line[i] = ~static_cast<size_t>(0);
+        }
+    }
+
+    last_row_ox = ox;
+    last_struct_gen = struct_gen;
+    last_sel_lo = sel_lo;
+    last_sel_hi = sel_hi;
+
+    // update status bar and system message, composed into the reused sbar
+    // string instead of concatenating temporaries
+    sbar.clear();
+    if (fname.empty())
+        sbar.append("[NEW FILE]");
+    else if (fname.length() >= 23)
+    {
+        sbar.append(fname, 0, 20);
+        sbar.append("...");
     }
+    else
+        sbar.append(fname);
+    if (fstate == 2)
+        sbar.append("[+]");
 
-    // update status bar and system message
-    std::string dname = (fname.length() >= 23 ? fname.substr(0, 20) + "..." : fname);
-    std::string info = (dname.empty() ? "[NEW FILE]" : dname) + (fstate == 2 ? "[+]" : "");
-    std::string position = "Ln " + std::to_string(cy + 1) + ", Col " + std::to_string(cx + 1);
-    sbar = info + std::string(mx - info.length() - position.length(), ' ') + position;
+    char position[32];
+    int plen = std::snprintf(position, sizeof(position), "Ln %u, Col %u", cy + 1, cx + 1);
+    if (sbar.length() + plen < mx)
+        sbar.append(mx - sbar.length() - plen, ' ');
+    sbar.append(position, plen);
+
+#ifdef MELT_PERF
+    // the HUD takes over the message line; timings shown are from frames
+    // already presented, so composing it costs the hot path nothing
+    if (hud_on)
+    {
+        char hud[128];
+        int hlen = std::snprintf(hud, sizeof(hud),
+                                 "frame %u/%u us | key %u/%u us (p50/p99) | load %.1f ms | save %.1f ms",
+                                 perf_frame.pct(50), perf_frame.pct(99), perf_key.pct(50), perf_key.pct(99),
+                                 perf_load_us / 1000.0, perf_save_us.load() / 1000.0);
+        smessage.assign(hud, hlen);
+    }
+#endif
 
     smessage.resize(mx, ' ');
 }
@@ -669,15 +3580,50 @@ void Melt::update()
 void Melt::render()
 {
     curs_set(0);
+
+    // write a cell range as runs of uniform attribute (addnstr: verbatim);
+    // text cells sit to the right of the line-number gutter. One move, then
+    // cursor-relative writes, so a run following multibyte text lands where
+    // the previous run's glyphs actually ended rather than at a byte offset
+    auto emitCells = [this](int row, size_t col, const std::string &txt, const std::string &at, size_t n) -> void {
+        n = std::min(n, txt.length() - col);
+        move(row, gut_w + col);
+        size_t i = col;
+        while (i < col + n)
+        {
+            size_t j = i;
+            char a = i < at.length() ? at[i] : '\0';
+            while (j < col + n && (j < at.length() ? at[j] : '\0') == a)
+                ++j;
+            if (a != 0)
+                attron(COLOR_PAIR(a + 1));
+            addnstr(txt.data() + i, j - i);
+            if (a != 0)
+                attroff(COLOR_PAIR(a + 1));
+            i = j;
+        }
+    };
+
+    // byte offsets equal screen columns only in pure ASCII rows
+    auto anyMB = [](const std::string &r) {
+        for (const char c : r)
+            if (static_cast<unsigned char>(c) & 0x80)
+                return true;
+        return false;
+    };
+
+    const bool full_redraw = is_ws_changed;
+
     if (is_ws_changed)
     {
         resize_term(0, 0);
         clear();
 
         front = back;
-        // complete redraw
+        front_attr = back_attr;
+        // complete redraw - addnstr does no %-formatting, so no escaping needed
         for (int i = 0; i < static_cast<int>(front.size()); ++i)
-            mvprintw(i, 0, escPercent(front[i]).c_str());
+            emitCells(i, 0, front[i], front_attr[i], front[i].length());
 
         is_ws_changed = false;
     }
@@ -685,33 +3631,99 @@ void Melt::render()
     {
         if (front.size() != back.size())
             front.resize(back.size());
+        if (front_attr.size() != back_attr.size())
+            front_attr.resize(back_attr.size());
 
         for (int i = 0; i < static_cast<int>(back.size()); ++i)
         {
-            if (i >= static_cast<int>(front.size()) || front[i] != back[i])
+            if (front[i] == back[i] && front_attr[i] == back_attr[i])
+                continue;
+
+            // a row with multibyte text (before or after the change) is
+            // re-emitted whole from column 0 - a damage span's byte start
+            // is not a column there - and cleared past what the narrower
+            // glyph run covers
+            if (anyMB(back[i]) || anyMB(front[i]))
             {
                 front[i] = back[i];
+                front_attr[i] = back_attr[i];
+                emitCells(i, 0, front[i], front_attr[i], front[i].length());
+                clrtoeol();
+                continue;
+            }
 
-                mvprintw(i, 0, escPercent(front[i]).c_str());
+            // emit only the damaged span of the row, not the whole line -
+            // a single keystroke then costs a handful of bytes on the wire;
+            // a cell is damaged if its glyph or its attribute changed
+            size_t lo = 0;
+            size_t hi = std::min(front[i].length(), back[i].length());
+            while (lo < hi && front[i][lo] == back[i][lo] && front_attr[i][lo] == back_attr[i][lo])
+                ++lo;
+
+            size_t fe = front[i].length();
+            size_t be = back[i].length();
+            while (fe > lo && be > lo && front[i][fe - 1] == back[i][be - 1] &&
+                   front_attr[i][fe - 1] == back_attr[i][be - 1])
+            {
+                --fe;
+                --be;
             }
+
+            // rows are always ax wide, but guard against length drift anyway
+            size_t span = std::max(fe, be) - lo;
+            front[i] = back[i];
+            front_attr[i] = back_attr[i];
+            emitCells(i, lo, front[i], front_attr[i], span);
+        }
+    }
+
+    // the gutter re-renders only when the viewport moves vertically, the
+    // line count changes (which rows past EOF get a blank cell), or the
+    // whole screen was redrawn; its width is constant within a frame
+    if (full_redraw || oy != last_gut_oy || lines.size() != last_gut_cnt)
+    {
+        char num[16];
+        for (unsigned i = 0; i < ay; ++i)
+        {
+            int len;
+            if (static_cast<size_t>(oy) + i < lines.size())
+                len = std::snprintf(num, sizeof(num), "%*u ", gut_w - 1, oy + i + 1);
+            else
+                len = std::snprintf(num, sizeof(num), "%*s ", gut_w - 1, "");
+            mvaddnstr(i, 0, num, std::min<int>(len, gut_w));
         }
+        last_gut_oy = oy;
+        last_gut_cnt = lines.size();
     }
 
     attron(COLOR_PAIR(1));
-    // render status bar and system message
-    mvprintw(my - 2, 0, escPercent(sbar).c_str());
+    // render status bar and system message (addnstr: verbatim, no escaping)
+    mvaddnstr(my - 2, 0, sbar.data(), sbar.length());
     attroff(COLOR_PAIR(1));
-    mvprintw(my - 1, 0, escPercent(smessage).c_str());
+    mvaddnstr(my - 1, 0, smessage.data(), smessage.length());
 
     int visual_cx = 0;
     if (cy < lines.size()) {
-        std::string cursor_str = lines[cy].substr(0, cx);
-        visual_cx = static_cast<int>(visualLength(cursor_str));
+        visual_cx = static_cast<int>(visualColOf(lines[cy], cx));
     }
-    move(cy - oy, visual_cx - ox);
+    move(cy - oy, gut_w + visual_cx - ox);
     curs_set(1);
 
     refresh();
+
+    // remember what this frame showed so identical ones can be skipped
+    last_frame.edit_gen = edit_gen;
+    last_frame.struct_gen = struct_gen;
+    last_frame.buf_epoch = buf_epoch;
+    last_frame.cx = cx;
+    last_frame.cy = cy;
+    last_frame.ox = ox;
+    last_frame.oy = oy;
+    last_frame.fstate = fstate;
+    last_frame.sel_on = sel_on;
+    last_frame.sel_anchor = sel_anchor;
+    last_frame.smessage = smessage;
+    frame_valid = true;
 }
 
 //
@@ -779,59 +3791,419 @@ bool Melt::valFn(std::string_view fn)
 }
 
 //
-// convert % to %% to avoid the use of formatting
+// expand \t to 4 spaces (my personal preference, feel free to change it)
 //
 
-std::string Melt::escPercent(std::string_view s)
+inline constexpr int tab_width = 4;
+std::string Melt::expandTabs(std::string_view s)
 {
     std::string ret{};
-    
-    for (char c : s)
+    ret.reserve(s.length());
+
+    // bulk-copy tab-free spans (found with the vectorized memchr) instead of
+    // walking and appending one character at a time
+    size_t col = 0;
+    size_t p = 0;
+    while (p < s.length())
     {
-        if (c == '%')
-            ret += "%%";
-        else
-            ret += c;
+        const char *tab = static_cast<const char *>(memchr(s.data() + p, '\t', s.length() - p));
+        size_t span = (tab != nullptr ? tab - (s.data() + p) : s.length() - p);
+        ret.append(s.data() + p, span);
+        col += span;
+        p += span;
+
+        if (tab != nullptr)
+        {
+            size_t spaces = tab_width - (col % tab_width);
+            ret.append(spaces, ' ');
+            col += spaces;
+            ++p;
+        }
     }
     return ret;
 }
 
 //
-// expand \t to 4 spaces (my personal preference, feel free to change it)
+// fetch the cached tab-expanded form of a line, rebuilding it if the line
+// was edited since the last frame
 //
 
-inline constexpr int tab_width = 4;
-std::string Melt::expandTabs(std::string_view s)
+const std::string &Melt::expandedOf(Line &l)
 {
-    std::string ret{};
+    if (!l.cache_ok)
+    {
+        l.expanded = expandTabs(l.text());
+        l.cache_ok = true;
+    }
+    return l.expanded;
+}
 
-    int col = 0;
-    for (char c : s)
+//
+// translate a byte column to a visual column through the line's cached tab
+// table - no allocation and no prefix rescans once the table is built
+//
+
+size_t Melt::visualColOf(Line &l, const size_t x)
+{
+    if (!l.tabs_ok)
     {
-        if (c == '\t')
+        l.tab_cols.clear();
+        std::string_view t = l.text();
+        size_t col = 0;
+        size_t p = 0;
+        while (p < t.length())
         {
-            int spaces = tab_width - (col % tab_width);
-            ret.append(spaces, ' ');
-            col += spaces;
+            const char *tab = static_cast<const char *>(memchr(t.data() + p, '\t', t.length() - p));
+            size_t span = (tab != nullptr ? tab - (t.data() + p) : t.length() - p);
+            col += span;
+            p += span;
+
+            if (tab != nullptr)
+            {
+                col += tab_width - (col % tab_width);
+                l.tab_cols.emplace_back(static_cast<unsigned>(p), static_cast<unsigned>(col));
+                ++p;
+            }
+        }
+        l.tabs_ok = true;
+    }
+
+    // multibyte lines walk the prefix instead - continuation bytes occupy
+    // no cell, so byte and visual columns drift apart. ASCII lines (the
+    // common case) never reach this
+    if (l.multibyte())
+    {
+        std::string_view t = l.text();
+        size_t col = 0;
+        size_t lim = std::min(x, t.length());
+        for (size_t i = 0; i < lim; ++i)
+        {
+            unsigned char c = t[i];
+            if (c == '\t')
+                col += tab_width - (col % tab_width);
+            else if ((c & 0xC0) != 0x80)
+                ++col;
+        }
+        return col;
+    }
+
+    if (l.tab_cols.empty())
+        return x;
+
+    // last tab strictly before x determines the visual offset of the rest
+    auto it = std::lower_bound(l.tab_cols.begin(), l.tab_cols.end(), x,
+                               [](const std::pair<unsigned, unsigned> &e, size_t v) { return e.first < v; });
+    if (it == l.tab_cols.begin())
+        return x;
+    --it;
+    return it->second + (x - (it->first + 1));
+}
+
+//
+// windowed row extraction for very long lines - seek straight to visual
+// column ox through the tab checkpoints and emit exactly one screen width
+// of cells, so cost is O(ax) regardless of how long the line is and no
+// multi-megabyte expansion is ever cached
+//
+
+void Melt::fillVisibleLong(Line &l, std::string &row)
+{
+    std::string_view t = l.text();
+    row.clear();
+
+    // build the checkpoint table if needed (identity mapping when no tabs)
+    visualColOf(l, 0);
+
+    if (l.tab_cols.empty())
+    {
+        if (t.length() > ox)
+            row.assign(t.substr(ox, ax));
+        row.resize(ax, ' ');
+        return;
+    }
+
+    // seek: last checkpoint at or before ox, then jump within its segment -
+    // at most one tab can straddle the target column
+    size_t b = 0, col = 0;
+    auto it = std::upper_bound(l.tab_cols.begin(), l.tab_cols.end(), static_cast<size_t>(ox),
+                               [](size_t v, const std::pair<unsigned, unsigned> &e) { return v < e.second; });
+    if (it != l.tab_cols.begin())
+    {
+        // a checkpoint is (tab byte, visual column after it): resume at the
+        // byte past the tab, which sits exactly at that column
+        auto p = std::prev(it);
+        b = p->first + 1;
+        col = p->second;
+    }
+
+    size_t next_tab = (it != l.tab_cols.end() ? it->first : t.length());
+    size_t tab_vis = col + (next_tab - b);
+    if (ox < tab_vis)
+    {
+        b += ox - col;
+        col = ox;
+    }
+    else
+    {
+        b = next_tab;
+        col = tab_vis;
+    }
+
+    // walk forward cell by cell; starts at most one tab before ox
+    while (b < t.length() && row.length() < ax)
+    {
+        if (t[b] == '\t')
+        {
+            for (size_t w = tab_width - (col % tab_width); w > 0; --w, ++col)
+                if (col >= ox && row.length() < ax)
+                    row += ' ';
         }
         else
         {
-            ret += c;
+            if (col >= ox)
+                row += t[b];
             ++col;
         }
+        ++b;
     }
-    return ret;
+    row.resize(ax, ' ');
 }
 
-size_t Melt::visualLength(std::string_view s)
+//
+// syntax highlighting - a small C-family lexer with one bit of cross-line
+// state (inside a block comment). Each line caches its attribute bytes plus
+// the state it was lexed with, so an edit re-lexes forward only until the
+// state chain reconverges with the cached one; idle frames lex nothing
+//
+
+void Melt::updateHlMode()
 {
-    size_t len = 0;
-    for (char c : s)
+    static const std::unordered_set<std::string_view> exts = {".c",   ".h",   ".cc",  ".hh", ".cpp",
+                                                              ".hpp", ".cxx", ".hxx", ".cu"};
+    bool on = false;
+    if (size_t dot = fname.rfind('.'); dot != std::string::npos)
+        on = exts.count(std::string_view{fname}.substr(dot)) > 0;
+    if (on != hl_on)
     {
-        if (c == '\t')
-            len += tab_width - (len % tab_width);
-        else
-            ++len;
+        hl_on = on;
+        is_ws_changed = true;
+    }
+}
+
+void Melt::ensureLexed(size_t upto)
+{
+    upto = std::min(upto, lines.size());
+    for (size_t i = lex_clean; i < upto; ++i)
+    {
+        unsigned char in = i > 0 ? lines[i - 1].lex_out : 0;
+        Line &l = lines[i];
+        if (!l.lex_ok || l.lex_in != in)
+            lexLine(l, in);
+    }
+    lex_clean = std::max(lex_clean, upto);
+}
+
+void Melt::lexLine(Line &l, unsigned char in)
+{
+    static const std::unordered_set<std::string_view> keywords = {
+        "alignas",   "alignof",  "auto",     "bool",      "break",    "case",     "catch",    "char",
+        "class",     "const",    "continue", "constexpr", "default",  "delete",   "do",       "double",
+        "else",      "enum",     "explicit", "extern",    "false",    "float",    "for",      "friend",
+        "goto",      "if",       "inline",   "int",       "long",     "mutable",  "namespace", "new",
+        "noexcept",  "nullptr",  "operator", "private",   "protected", "public",  "return",   "short",
+        "signed",    "sizeof",   "static",   "struct",    "switch",   "template", "this",     "throw",
+        "true",      "try",      "typedef",  "typename",  "union",    "unsigned", "using",    "virtual",
+        "void",      "volatile", "while"};
+
+    // very long lines are rendered unhighlighted through the windowed path
+    // and shouldn't cache an expansion here; pass the lexer state through
+    if (l.length() >= LONG_LINE_MIN)
+    {
+        l.attrs.clear();
+        l.lex_in = in;
+        l.lex_out = in;
+        l.lex_ok = true;
+        return;
+    }
+
+    const std::string &s = expandedOf(l);
+    unsigned old_rev_state = static_cast<unsigned>(l.lex_out);
+    std::string old = std::move(l.attrs);
+
+    l.attrs.assign(s.length(), HL_NONE);
+    l.lex_in = in;
+    unsigned char st = in;
+
+    auto isIdent = [](char c) -> bool {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    };
+
+    size_t i = 0;
+    // a directive colors the whole line; comments inside are rare enough
+    // that treating them as part of the directive is an acceptable loss
+    if (st == 0)
+    {
+        size_t nb = s.find_first_not_of(' ');
+        if (nb != std::string::npos && s[nb] == '#')
+        {
+            l.attrs.assign(s.length(), HL_PREPROC);
+            i = s.length();
+        }
+    }
+
+    while (i < s.length())
+    {
+        if (st == 1)
+        {
+            size_t e = s.find("*/", i);
+            size_t stop = e == std::string::npos ? s.length() : e + 2;
+            std::fill(l.attrs.begin() + i, l.attrs.begin() + stop, HL_COMMENT);
+            i = stop;
+            if (e != std::string::npos)
+                st = 0;
+            continue;
+        }
+
+        char c = s[i];
+        if (c == '/' && i + 1 < s.length() && s[i + 1] == '/')
+        {
+            std::fill(l.attrs.begin() + i, l.attrs.end(), HL_COMMENT);
+            break;
+        }
+        if (c == '/' && i + 1 < s.length() && s[i + 1] == '*')
+        {
+            // consume the opener here so "/*/" can't close itself
+            std::fill(l.attrs.begin() + i, l.attrs.begin() + i + 2, HL_COMMENT);
+            i += 2;
+            st = 1;
+            continue;
+        }
+        if (c == '"' || c == '\'')
+        {
+            size_t j = i + 1;
+            while (j < s.length() && s[j] != c)
+                j += s[j] == '\\' ? 2 : 1;
+            size_t stop = std::min(j + 1, s.length());
+            std::fill(l.attrs.begin() + i, l.attrs.begin() + stop, HL_STRING);
+            i = stop;
+            continue;
+        }
+        if (c >= '0' && c <= '9' && (i == 0 || !isIdent(s[i - 1])))
+        {
+            size_t j = i;
+            while (j < s.length() && (isIdent(s[j]) || s[j] == '.'))
+                ++j;
+            std::fill(l.attrs.begin() + i, l.attrs.begin() + j, HL_NUMBER);
+            i = j;
+            continue;
+        }
+        if (isIdent(c) && !(c >= '0' && c <= '9'))
+        {
+            size_t j = i;
+            while (j < s.length() && isIdent(s[j]))
+                ++j;
+            if (keywords.count(std::string_view{s}.substr(i, j - i)) > 0)
+                std::fill(l.attrs.begin() + i, l.attrs.begin() + j, HL_KEYWORD);
+            i = j;
+            continue;
+        }
+        ++i;
+    }
+
+    l.lex_out = st;
+    l.lex_ok = true;
+
+    // a changed result must force row recomposition even if the text itself
+    // did not change (a block comment opened on an earlier line)
+    if (old != l.attrs || old_rev_state != st)
+        ++l.rev;
+}
+
+#ifdef MELT_BENCH
+//
+//
+// +---------------------+
+// | Benchmark harness   |
+// +---------------------+
+//
+//
+
+//
+// drives the editor headlessly against synthetic corpora and emits CSV so
+// regressions in load/edit/render/save cost can be tracked release to
+// release. Run via "make bench"; line counts can be overridden on argv
+//
+
+int benchMain(int argc, char **argv)
+{
+    using clock = std::chrono::steady_clock;
+    auto ms = [](clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(d).count();
+    };
+
+    std::vector<size_t> sizes{};
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(std::stoul(argv[i]));
+    if (sizes.empty())
+        sizes = {10000, 1000000};
+
+    std::printf("metric,lines,value,unit\n");
+
+    for (size_t n : sizes)
+    {
+        std::string path = "bench_corpus_" + std::to_string(n) + ".txt";
+        {
+            std::ofstream f{path};
+            for (size_t i = 0; i < n; ++i)
+                f << "line " << i << "\tlorem ipsum dolor sit amet consectetur adipiscing elit\n";
+        }
+
+        Melt med{};
+        char prog[] = "mel";
+        char *args[] = {prog, path.data(), nullptr};
+
+        auto t0 = clock::now();
+        med.init(2, args);
+        std::printf("load_ms,%zu,%.3f,ms\n", n, ms(clock::now() - t0));
+
+        // keystroke-to-frame latency: one full apply/update/render per key
+        const int keys = 2000;
+        t0 = clock::now();
+        for (int i = 0; i < keys; ++i)
+        {
+            bench_keys.push_back('x');
+            med.processEvents();
+            med.update();
+            med.render();
+        }
+        std::printf("keystroke_us,%zu,%.3f,us\n", n, ms(clock::now() - t0) * 1000.0 / keys);
+
+        // scroll throughput, one rendered frame per step
+        const int steps = 5000;
+        t0 = clock::now();
+        for (int i = 0; i < steps; ++i)
+        {
+            bench_keys.push_back(KEY_DOWN);
+            med.processEvents();
+            med.update();
+            med.render();
+        }
+        double sec = ms(clock::now() - t0) / 1000.0;
+        std::printf("scroll_steps_per_s,%zu,%.0f,steps/s\n", n, steps / (sec > 0 ? sec : 1e-9));
+
+        // full-buffer save through the same writer the async path uses
+        auto snap = med.lines.snapshot();
+        t0 = clock::now();
+        Melt::writeLines(snap, path + ".out");
+        std::printf("save_ms,%zu,%.3f,ms\n", n, ms(clock::now() - t0));
+
+        med.shutdown();
+        fsystem::remove(path);
+        fsystem::remove(path + ".out");
     }
-    return len;
+
+    return 0;
 }
+
+int main(int argc, char **argv) { return benchMain(argc, argv); }
+#endif